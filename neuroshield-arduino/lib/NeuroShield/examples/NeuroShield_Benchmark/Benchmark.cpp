@@ -0,0 +1,326 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board Benchmark
+ *  Copyright (c) 2017 nepes inc.
+ *  
+ *  Each line reports an operation with the vector length and the number
+ *  of committed neurons it ran with:
+ *    us/op      measured time of one call
+ *    frames/op  SPI frames (slave select cycles) of one call
+ *    bytes/op   bytes clocked on the bus by one call
+ *    bus_us/op  time of these frames and bytes on a real link at the spi
+ *               clock of the shield, with BENCH_FRAME_NS per frame
+ *  The frames and bytes are counted by the NM500 emulator, or on the board
+ *  by the library built with NEUROSHIELD_STATS=1, otherwise only us/op is
+ *  available.
+ *  
+ *  On Linux, build with the library sources (the emulator replaces the
+ *  board):
+ *    g++ -O2 -pthread -I../../src ../../src/NM500*.cpp ../../src/NeuroShield*.cpp Benchmark.cpp -o benchmark
+ ******************************************************************************/
+
+#include "Benchmark.h"
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <NM500Emulator.h>
+#include <stdio.h>
+#include <time.h>
+#endif
+
+// calls averaged by each measurement
+#ifndef BENCH_REPEAT
+#if defined(ARDUINO)
+#define BENCH_REPEAT	20
+#else
+#define BENCH_REPEAT	200
+#endif
+#endif
+
+// slave select and transaction setup of a frame, in ns
+#ifndef BENCH_FRAME_NS
+#define BENCH_FRAME_NS	2000
+#endif
+
+#define BENCH_FILE		"bench.knf"
+
+static NeuroShield* nn;
+static uint8_t vector[NEURON_SIZE];
+static uint16_t words[NEURON_SIZE + 4];
+static uint16_t seed = 1;
+
+static const uint16_t lengths[] = { 16, 64, 128, NEURON_SIZE };
+
+// ------------------------------------------------------------
+// Platform helpers
+// ------------------------------------------------------------
+static uint32_t now() {
+#if defined(ARDUINO)
+	return (micros());
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint32_t)ts.tv_sec * 1000000UL + (uint32_t)(ts.tv_nsec / 1000));
+#endif
+}
+
+static void print(const char* s) {
+#if defined(ARDUINO)
+	Serial.print(s);
+#else
+	fputs(s, stdout);
+#endif
+}
+
+static void print(uint32_t value) {
+#if defined(ARDUINO)
+	Serial.print(value);
+#else
+	printf("%lu", (unsigned long)value);
+#endif
+}
+
+static void print(float value) {
+#if defined(ARDUINO)
+	Serial.print(value, 1);
+#else
+	printf("%.1f", value);
+#endif
+}
+
+// ------------------------------------------------------------
+// Measurement of a sequence of calls
+// ------------------------------------------------------------
+#if defined(NM500_EMULATOR) || NEUROSHIELD_STATS
+#define BENCH_BUS
+#endif
+
+struct Sample {
+	uint32_t time;
+	uint32_t frames;
+	uint32_t bytes;
+};
+
+#if defined(BENCH_BUS)
+static void busCount(uint32_t& frames, uint32_t& bytes) {
+#if defined(NM500_EMULATOR)
+	frames = nn->spi.emulator->frames;
+	bytes = nn->spi.emulator->bytes;
+#else
+	NeuroShieldSPI::Stats stats;
+	nn->spi.getStats(&stats);
+	frames = stats.frames;
+	bytes = stats.bytes;
+#endif
+}
+#endif
+
+static void start(Sample& s) {
+#if defined(BENCH_BUS)
+	busCount(s.frames, s.bytes);
+#endif
+	s.time = now();
+}
+
+static void report(const char* op, uint16_t length, uint16_t ncount, uint16_t repeat, Sample& s) {
+	uint32_t time = now() - s.time;
+	print(op); print("\t");
+	print((uint32_t)length); print("\t");
+	print((uint32_t)ncount); print("\t");
+	print((float)time / repeat); print("\t");
+#if defined(BENCH_BUS)
+	uint32_t frames, bytes;
+	busCount(frames, bytes);
+	frames -= s.frames;
+	bytes -= s.bytes;
+	float bus_ns = ((float)bytes * 8.0f * 1e9f / nn->getSpiClock()) + ((float)frames * BENCH_FRAME_NS);
+	print((float)frames / repeat); print("\t");
+	print((float)bytes / repeat); print("\t");
+	print(bus_ns / 1000.0f / repeat);
+#else
+	print("-\t-\t-");
+#endif
+	print("\n");
+}
+
+// ------------------------------------------------------------
+// Test patterns
+// ------------------------------------------------------------
+static uint8_t nextRandom() {
+	seed = seed * 25173 + 13849;
+	return ((uint8_t)(seed >> 8));
+}
+
+static void randomVector(uint16_t length) {
+	for (uint16_t i = 0; i < length; i++)
+		vector[i] = nextRandom();
+}
+
+// learn random vectors until ncount neurons are committed
+static uint16_t fill(uint16_t ncount, uint16_t length) {
+	uint16_t committed = 0;
+	nn->forget();
+	for (uint16_t i = 0; (committed < ncount) && (i < (ncount * 4)); i++) {
+		randomVector(length);
+		committed = nn->learn(vector, length, 1 + (i % 100));
+	}
+	return (committed);
+}
+
+// ------------------------------------------------------------
+// Benchmarks
+// ------------------------------------------------------------
+static void benchRegisters() {
+	Sample s;
+	uint16_t ncount = nn->getNcount();
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->spi.read(NM_MINIF);
+	report("read", 1, ncount, BENCH_REPEAT, s);
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->spi.write(NM_MINIF, 2);
+	report("write", 1, ncount, BENCH_REPEAT, s);
+}
+
+static void benchVectors(uint16_t length) {
+	Sample s;
+	uint16_t ncount = fill(1, length);
+
+	randomVector(length);
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->spi.writeVector(vector, length);
+	report("writeVector", length, ncount, BENCH_REPEAT, s);
+
+	nn->beginNeuronRead();
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->spi.readVector16(words, length);
+	report("readVector16", length, ncount, BENCH_REPEAT, s);
+	nn->endNeuronRead();
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->broadcast(vector, length);
+	report("broadcast", length, ncount, BENCH_REPEAT, s);
+}
+
+static void benchLearn(uint16_t length) {
+	Sample s;
+	uint16_t ncount = 0;
+	nn->forget();
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++) {
+		randomVector(length);
+		ncount = nn->learn(vector, length, 1 + r);
+	}
+	report("learn", length, ncount, BENCH_REPEAT, s);
+}
+
+static void benchClassify(uint16_t length, uint16_t neurons) {
+	Sample s;
+	uint16_t dist, cat, nid;
+	uint16_t dists[3], cats[3], nids[3];
+	uint16_t ncount = fill(neurons, length);
+
+	randomVector(length);
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->classify(vector, length);
+	report("classify", length, ncount, BENCH_REPEAT, s);
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->classify(vector, length, &dist, &cat, &nid);
+	report("classify top-1", length, ncount, BENCH_REPEAT, s);
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->classify(vector, length, 3, dists, cats, nids);
+	report("classify top-3", length, ncount, BENCH_REPEAT, s);
+}
+
+static bool skipNeuron(void*, uint16_t, const NeuroShield::Neuron&, const uint8_t[], uint16_t) {
+	return (true);
+}
+
+static void benchNeurons(uint16_t length) {
+	Sample s;
+	uint16_t ncount = fill(BENCH_REPEAT, length);
+
+	// one read session, each neuron read from where the chain stopped
+	start(s);
+	nn->beginNeuronRead();
+	for (uint16_t r = 0; r < ncount; r++)
+		nn->readNeuron(r + 1, words, length);
+	nn->endNeuronRead();
+	report("readNeuron", length, ncount, ncount, s);
+
+	start(s);
+	nn->forEachNeuron(skipNeuron, NULL, length);
+	report("forEachNeuron", length, ncount, ncount, s);
+
+	start(s);
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		nn->writeNeurons(words, 1, length);
+	report("writeNeurons", length, 1, BENCH_REPEAT, s);
+}
+
+#if NEUROSHIELD_SDCARD
+static void benchKnowledge(uint16_t length) {
+	Sample s;
+	uint16_t ncount = fill(nn->total_neurons, length);
+
+	start(s);
+	nn->saveKnowledgeToSDcard((char*)BENCH_FILE, length);
+	report("saveKnowledge", length, ncount, 1, s);
+
+	start(s);
+	nn->loadKnowledgeFromSDcard((char*)BENCH_FILE);
+	report("loadKnowledge", length, ncount, 1, s);
+}
+#else
+// the knowledge file rows are listed without an SD card, unmeasured
+static void benchKnowledge(uint16_t length) {
+	static const char* const ops[2] = { "saveKnowledge", "loadKnowledge" };
+	for (uint8_t i = 0; i < 2; i++) {
+		print(ops[i]); print("\t");
+		print((uint32_t)length); print("\t");
+		print("-\tnot measured\n");
+	}
+}
+#endif
+
+void runBenchmark(NeuroShield& neuroshield) {
+	nn = &neuroshield;
+	print("\nspi clock "); print(nn->getSpiClock()); print(" Hz, ");
+	print((uint32_t)nn->total_neurons); print(" neurons\n");
+	print("op\tlength\tneurons\tus/op\tframes/op\tbytes/op\tbus_us/op\n");
+
+	benchRegisters();
+	for (uint8_t i = 0; i < (sizeof(lengths) / sizeof(lengths[0])); i++) {
+		uint16_t length = lengths[i];
+		benchVectors(length);
+		benchLearn(length);
+		benchClassify(length, 1);
+		benchClassify(length, 64);
+		benchClassify(length, nn->total_neurons);
+		benchNeurons(length);
+		benchKnowledge(length);
+	}
+	nn->forget();
+	print("done\n");
+}
+
+#if !defined(ARDUINO)
+int main() {
+	static NeuroShield hnn;
+	if (hnn.begin() == 0)
+		return (1);
+	runBenchmark(hnn);
+	return (0);
+}
+#endif
@@ -0,0 +1,15 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board Benchmark
+ *  Copyright (c) 2017 nepes inc.
+ ******************************************************************************/
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <NeuroShield.h>
+
+// run every measurement on nn and print one line per operation
+// the knowledge of nn is lost
+void runBenchmark(NeuroShield& nn);
+
+#endif
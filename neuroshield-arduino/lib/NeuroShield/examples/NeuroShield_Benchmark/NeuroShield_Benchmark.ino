@@ -0,0 +1,34 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board Benchmark
+ *  Time, frames and bytes on the SPI bus of each driver operation,
+ *  for several vector lengths and neuron counts
+ *  Copyright (c) 2017 nepes inc.
+ *  
+ *  The same benchmark runs on Linux against the NM500 emulator of the
+ *  library, see Benchmark.cpp
+ ******************************************************************************/
+
+#include <NeuroShield.h>
+#include "Benchmark.h"
+
+#define NM500_SPI_SS 7
+
+NeuroShield hnn;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial);    // wait for the serial port to open
+
+  if (hnn.begin(NM500_SPI_SS) == 0) {
+    Serial.print("\nNM500 is NOT properly connected!!");
+    Serial.print("\nCheck the connection and Reboot again!\n");
+    while (1);
+  }
+
+  // uncomment to measure another spi clock
+  //hnn.setSpiClock(8000000);
+  runBenchmark(hnn);
+}
+
+void loop() {
+}
@@ -24,6 +24,18 @@ uint16_t dists[READ_COUNT], cats[READ_COUNT], nids[READ_COUNT];
 uint16_t fpga_version;
 int i, j;
 
+// display a committed neuron, called by forEachNeuron() for each of them
+bool printNeuron(void* ctx, uint16_t nid, const NeuroShield::Neuron& neuron, const uint8_t model[], uint16_t length) {
+  Serial.print("\nneuron#"); Serial.print(nid); Serial.print("\tmodel=");
+  for (j = 0; j < length; j++) {
+    Serial.print(model[j]); Serial.print(", ");
+  }
+  Serial.print("\tncr="); Serial.print(neuron.ncr);
+  Serial.print("\taif="); Serial.print(neuron.aif);
+  Serial.print("\tcat="); Serial.print(neuron.cat & 0x7FFF); if (neuron.cat & 0x8000) Serial.print(" (degenerated)");
+  return (true);
+}
+
 void setup() {
   Serial.begin(9600);
   while (!Serial);    // wait for the serial port to open
@@ -67,17 +79,7 @@ void setup() {
   ncount = hnn.learn(vector, VECTOR_LENGTH, 100);
   // display the content of the committed neurons
   Serial.print("\nDisplay the neurons, count="); Serial.print(ncount);
-  uint16_t model[NEURON_SIZE];
-  for (i = 1; i <= ncount; i++) {
-      hnn.readNeuron(i, model, &ncr, &aif, &cat);
-      Serial.print("\nneuron#"); Serial.print(i); Serial.print("\tmodel=");
-      for (j = 0; j < VECTOR_LENGTH; j++) {
-        Serial.print(model[j]); Serial.print(", ");
-      }
-      Serial.print("\tncr="); Serial.print(ncr);  
-      Serial.print("\taif="); Serial.print(aif);     
-      Serial.print("\tcat="); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
-  }
+  hnn.forEachNeuron(printNeuron, NULL, VECTOR_LENGTH);
   
   for (value = 12; value < 16; value++) {
       Serial.print("\n\nRecognizing a new pattern: ");
@@ -115,16 +117,7 @@ void setup() {
   ncount = hnn.learn(vector, VECTOR_LENGTH, 100);
   // display the content of the committed neurons
   Serial.print("\nDisplay the neurons, count="); Serial.print(ncount);
-  for (i = 1; i <= ncount; i++) {
-      hnn.readNeuron(i, model, &ncr, &aif, &cat);
-      Serial.print("\nneuron#"); Serial.print(i); Serial.print("\tmodel=");
-      for (j = 0; j < VECTOR_LENGTH; j++) {
-        Serial.print(model[j]); Serial.print(", ");
-      }
-      Serial.print("\tncr="); Serial.print(ncr);  
-      Serial.print("\taif="); Serial.print(aif);     
-      Serial.print("\tcat="); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
-  }
+  hnn.forEachNeuron(printNeuron, NULL, VECTOR_LENGTH);
   Serial.print("\n=> Notice the addition of neuron 4 and the shrinking of the influence fields of neuron1 and 2");
 
   Serial.print("\n\nLearning a same example (13) using a different category 77");
@@ -133,16 +126,7 @@ void setup() {
   ncount = hnn.learn(vector, VECTOR_LENGTH, 77);
   // display the content of the committed neurons
   Serial.print("\nDisplay the neurons, count="); Serial.print(ncount);
-  for (i = 1; i <= ncount; i++) {
-      hnn.readNeuron(i, model, &ncr, &aif, &cat);
-      Serial.print("\nneuron#"); Serial.print(i); Serial.print("\tmodel=");
-      for (j = 0; j < VECTOR_LENGTH; j++) {
-        Serial.print(model[j]); Serial.print(", ");
-      }
-      Serial.print("\tncr="); Serial.print(ncr);  
-      Serial.print("\taif="); Serial.print(aif);     
-      Serial.print("\tcat="); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
-  }
+  hnn.forEachNeuron(printNeuron, NULL, VECTOR_LENGTH);
   Serial.print("\n=> Notice if the AIF of a neuron reaches the MINIF, the neuron will be degenerated");
 
   Serial.print("\n\nLearning a new example (12) using context 5, category 200");
@@ -153,16 +137,7 @@ void setup() {
   hnn.setContext(1);
   // display the content of the committed neurons
   Serial.print("\nDisplay the neurons, count="); Serial.print(ncount);
-  for (i = 1; i <= ncount; i++) {
-      hnn.readNeuron(i, model, &ncr, &aif, &cat);
-      Serial.print("\nneuron#"); Serial.print(i); Serial.print("\tmodel=");
-      for (j = 0; j < VECTOR_LENGTH; j++) {
-        Serial.print(model[j]); Serial.print(", ");
-      }
-      Serial.print("\tncr="); Serial.print(ncr);  
-      Serial.print("\taif="); Serial.print(aif);     
-      Serial.print("\tcat="); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
-  }
+  hnn.forEachNeuron(printNeuron, NULL, VECTOR_LENGTH);
 
   Serial.print("\n\nRecognizing a new pattern using context 5: ");
   for (i = 0; i < VECTOR_LENGTH; i++)
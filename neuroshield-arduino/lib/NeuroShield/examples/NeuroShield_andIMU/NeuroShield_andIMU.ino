@@ -14,11 +14,13 @@
 #include <Wire.h>
 #include <MPU6050.h>
 #include <NeuroShield.h>
+#include <NeuroShieldFeatures.h>
 
 // for NM500 
 #define MOTION_REPEAT_COUNT 3  // number of samples to assemble a vector
 #define MOTION_SIGNAL_COUNT 8  // d_ax, d_ay, d_az, d_gx, d_gy, d_gz, da, dg
 #define MOTION_CAPTURE_COUNT 20
+#define MOTION_WINDOW (MOTION_CAPTURE_COUNT + 1)  // samples of a vector
 
 #define DEFAULT_MAXIF 500
 
@@ -26,6 +28,7 @@
 
 NeuroShield hnn;
 MPU6050 mpu(0x68);
+NeuroShieldFeatures<6, MOTION_WINDOW> motion;  // ax, ay, az, gx, gy, gz over the last MOTION_WINDOW samples
 
 int16_t ax, ay, az, gx, gy, gz;
 
@@ -137,7 +140,11 @@ void loop() {
       learn_cat = learn_cat - '0';
       if (learn_cat < 4) {    // learn_cat 0 ~ 3
         Serial.print("\nLearning motion category "); Serial.print(learn_cat);
+        while (hnn.poll());   // finish the pending recognition
         for (int i = 0; i < 5; i++) {
+          // a new window of samples for each vector
+          for (int j = 0; j < MOTION_WINDOW; j++)
+            sampleMotion();
           extractFeatureVector();
           ncount = hnn.learn(vector, MOTION_REPEAT_COUNT * MOTION_SIGNAL_COUNT, learn_cat);
           if (ncount != prev_ncount) {
@@ -153,118 +160,62 @@ void loop() {
       }
   }
   else {
-    // recognize
-    extractFeatureVector();
-    hnn.classify(vector, MOTION_REPEAT_COUNT * MOTION_SIGNAL_COUNT, &dist, &cat, &nid);
-    if (cat != 0xFFFF) {
-      prev_cat = cat;
-      Serial.print("\nMotion #"); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
-    }
-    else if (prev_cat != 0xFFFF) {
-      prev_cat = cat;
+    // recognize the window of the last samples, the recognition moves
+    // forward one step per sample and the next one starts once it is over
+    sampleMotion();
+    if (motion.ready() && !hnn.busy()) {
+      extractFeatureVector();
+      hnn.classifyAsync(vector, MOTION_REPEAT_COUNT * MOTION_SIGNAL_COUNT, onRecognized, NULL);
     }
   }
 }
 
+void onRecognized(void* ctx, const NeuroShield::Result& result)
+{
+  // the overlapping windows recognize a motion many times, report its changes
+  cat = result.cat;
+  if ((cat != 0xFFFF) && ((cat & 0x7FFF) != prev_cat)) {
+    prev_cat = cat & 0x7FFF;
+    Serial.print("\nMotion #"); Serial.print(cat & 0x7FFF); if (cat & 0x8000) Serial.print(" (degenerated)");
+  }
+  else if (prev_cat != 0xFFFF) {
+    prev_cat = cat;
+  }
+}
+
 ////////////////////////////////////////////////////////////
-// extract feature
+// read a sample of the mpu6050 into the window
 ////////////////////////////////////////////////////////////
-void extractFeatureVector()
+void sampleMotion()
 {
-  int i;
-  int16_t min_ax, min_ay, min_az, max_ax, max_ay, max_az;
-  int16_t min_gx, min_gy, min_gz, max_gx, max_gy, max_gz;
-  uint32_t norm_ax, norm_ay, norm_az, norm_gx, norm_gy, norm_gz;
-  int32_t d_ax, d_ay, d_az, d_gx, d_gy, d_gz;
-  int32_t da_local, dg_local;
-
   mpu.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
-  
-  max_ax = min_ax = ax;
-  max_ay = min_ay = ay;
-  max_az = min_az = az;
-  max_gx = min_gx = gx;
-  max_gy = min_gy = gy;
-  max_gz = min_gz = gz;
-  
-  for (i = 0; i < MOTION_CAPTURE_COUNT; i++) {
-    mpu.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
-    
-    if (ax < min_ax)
-      min_ax = ax;
-    else if (ax > max_ax)
-      max_ax = ax;
-    
-    if (ay < min_ay)
-      min_ay = ay;
-    else if(ay > max_ay)
-      max_ay = ay;
-    
-    if (az < min_az)
-      min_az = az;
-    else if (az > max_az)
-      max_az = az;
-
-    if (gx < min_gx)
-      min_gx = gx;
-    else if (gx > max_gx)
-      max_gx = gx;
-    
-    if (gy < min_gy)
-      min_gy = gy;
-    else if (gy > max_gy)
-      max_gy = gy;
-    
-    if (gz < min_gz)
-      min_gz = gz;
-    else if (gz > max_gz)
-      max_gz = gz;
-  }
-    
-  d_ax = max_ax - min_ax;
-  d_ay = max_ay - min_ay;
-  d_az = max_az - min_az;
-
-  d_gx = max_gx - min_gx;
-  d_gy = max_gy - min_gy;
-  d_gz = max_gz - min_gz;
-
-  da_local = d_ax;
-  if (d_ay > da_local)
-    da_local = d_ay;
-  if (d_az > da_local)
-    da_local = d_az;
-
-  dg_local = d_gx;
-  if (d_gy > dg_local)
-    dg_local = d_gy;
-  if (d_gz > dg_local)
-    dg_local = d_gz;
-
-  norm_ax = d_ax; norm_ax = norm_ax * 255 / da_local;
-  norm_ay = d_ay; norm_ay = norm_ay * 255 / da_local;
-  norm_az = d_az; norm_az = norm_az * 255 / da_local;
-
-  norm_gx = d_gx; norm_gx = norm_gx * 255 / dg_local;
-  norm_gy = d_gy; norm_gy = norm_gy * 255 / dg_local;
-  norm_gz = d_gz; norm_gz = norm_gz * 255 / dg_local;
+  hnn.poll();   // next step of the pending recognition, if any
+  int16_t sample[6] = { ax, ay, az, gx, gy, gz };
+  motion.push(sample);
+}
 
-  for (i = 0; i < MOTION_REPEAT_COUNT; i++) {
-    vector[i * MOTION_SIGNAL_COUNT] = norm_ax & 0x00ff;
-    vector[(i * MOTION_SIGNAL_COUNT) + 1] = norm_ay & 0x00ff;
-    vector[(i * MOTION_SIGNAL_COUNT) + 2] = norm_az & 0x00ff;
-    vector[(i * MOTION_SIGNAL_COUNT) + 3] = norm_gx & 0x00ff;
-    vector[(i * MOTION_SIGNAL_COUNT) + 4] = norm_gy & 0x00ff;
-    vector[(i * MOTION_SIGNAL_COUNT) + 5] = norm_gz & 0x00ff;
-    if (da_local >= 4096)
-      vector[(i * MOTION_SIGNAL_COUNT) + 6] = 0xff;
-    else
-      vector[(i * MOTION_SIGNAL_COUNT) + 6] = ((da_local >> 4) & 0x00ff);
-    if (dg_local >= 4096)
-      vector[(i * MOTION_SIGNAL_COUNT) + 7] = 0xff;
-    else
-      vector[(i * MOTION_SIGNAL_COUNT) + 7] = ((dg_local >> 4) & 0x00ff);
-  }
+////////////////////////////////////////////////////////////
+// extract feature
+// range of each axis over the window, relative to the largest
+// range of the accelerations and of the rotations, and these two
+////////////////////////////////////////////////////////////
+void extractFeatureVector()
+{
+  uint16_t da_local, dg_local;
+
+  da_local = motion.scaleRanges(0, 3, &vector[0]);
+  dg_local = motion.scaleRanges(3, 3, &vector[3]);
+  if (da_local >= 4096)
+    vector[6] = 0xff;
+  else
+    vector[6] = ((da_local >> 4) & 0x00ff);
+  if (dg_local >= 4096)
+    vector[7] = 0xff;
+  else
+    vector[7] = ((dg_local >> 4) & 0x00ff);
+
+  for (int i = 1; i < MOTION_REPEAT_COUNT; i++)
+    memcpy(&vector[i * MOTION_SIGNAL_COUNT], vector, MOTION_SIGNAL_COUNT);
 }
 
 ////////////////////////////////////////////////////////////
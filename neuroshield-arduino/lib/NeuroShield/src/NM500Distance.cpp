@@ -0,0 +1,261 @@
+/*
+ * NM500Distance.cpp - Distance kernels of the NM500 emulator
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NeuroShield.h>
+#include <NeuroShieldSPI.h>
+
+#if defined(NM500_EMULATOR)
+
+#include <NM500Distance.h>
+
+extern "C" {
+  #include <stdint.h>
+  #include <string.h>
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NM500_DISTANCE_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*DistanceKernel)(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[]);
+
+// ------------------------------------------------------------
+// Scalar kernels
+// ------------------------------------------------------------
+static void distanceL1Scalar(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	for (uint32_t n = 0; n < count; n++) {
+		const uint8_t* model = &models[n * NEURON_SIZE];
+		uint16_t d = 0;
+		for (uint16_t i = 0; i < length; i++)
+			d += (vector[i] > model[i]) ? (vector[i] - model[i]) : (model[i] - vector[i]);
+		dist[n] = d;
+	}
+}
+
+static void distanceLsupScalar(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	for (uint32_t n = 0; n < count; n++) {
+		const uint8_t* model = &models[n * NEURON_SIZE];
+		uint8_t d = 0;
+		for (uint16_t i = 0; i < length; i++) {
+			uint8_t diff = (vector[i] > model[i]) ? (vector[i] - model[i]) : (model[i] - vector[i]);
+			if (diff > d)
+				d = diff;
+		}
+		dist[n] = d;
+	}
+}
+
+#if defined(NM500_DISTANCE_X86)
+
+// ------------------------------------------------------------
+// SSE2 kernels, 16 components per step
+// The vector is copied zero-padded and the last partial block of the
+// prototypes is masked, so the components past length count as 0.
+// L1 uses psadbw, Lsup the larger of the two saturated differences.
+// ------------------------------------------------------------
+__attribute__((target("sse2")))
+static void distanceL1Sse2(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	uint8_t padded[NEURON_SIZE] __attribute__((aligned(16))) = { 0 };
+	memcpy(padded, vector, length);
+	uint16_t blocks = length >> 4;
+	bool tail = (length & 15) != 0;
+	uint8_t tail_mask[16] __attribute__((aligned(16)));
+	for (uint16_t i = 0; i < 16; i++)
+		tail_mask[i] = (((length - 1) & 15) >= i) ? 0xFF : 0x00;
+	__m128i mask = _mm_load_si128((const __m128i*)tail_mask);
+
+	for (uint32_t n = 0; n < count; n++) {
+		const __m128i* model = (const __m128i*)&models[n * NEURON_SIZE];
+		__m128i acc = _mm_setzero_si128();
+		for (uint16_t b = 0; b < blocks; b++)
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_load_si128(&model[b]), _mm_load_si128((const __m128i*)&padded[b << 4])));
+		if (tail)
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_and_si128(_mm_load_si128(&model[blocks]), mask), _mm_load_si128((const __m128i*)&padded[blocks << 4])));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+		dist[n] = (uint16_t)_mm_cvtsi128_si32(acc);
+	}
+}
+
+__attribute__((target("sse2")))
+static void distanceLsupSse2(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	uint8_t padded[NEURON_SIZE] __attribute__((aligned(16))) = { 0 };
+	memcpy(padded, vector, length);
+	uint16_t blocks = length >> 4;
+	bool tail = (length & 15) != 0;
+	uint8_t tail_mask[16] __attribute__((aligned(16)));
+	for (uint16_t i = 0; i < 16; i++)
+		tail_mask[i] = (((length - 1) & 15) >= i) ? 0xFF : 0x00;
+	__m128i mask = _mm_load_si128((const __m128i*)tail_mask);
+
+	for (uint32_t n = 0; n < count; n++) {
+		const __m128i* model = (const __m128i*)&models[n * NEURON_SIZE];
+		__m128i acc = _mm_setzero_si128();
+		for (uint16_t b = 0; b <= blocks; b++) {
+			if ((b == blocks) && !tail)
+				break;
+			__m128i m = _mm_load_si128(&model[b]);
+			if (b == blocks)
+				m = _mm_and_si128(m, mask);
+			__m128i v = _mm_load_si128((const __m128i*)&padded[b << 4]);
+			acc = _mm_max_epu8(acc, _mm_or_si128(_mm_subs_epu8(m, v), _mm_subs_epu8(v, m)));
+		}
+		acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 4));
+		acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 2));
+		acc = _mm_max_epu8(acc, _mm_srli_si128(acc, 1));
+		dist[n] = (uint16_t)(_mm_cvtsi128_si32(acc) & 0x00FF);
+	}
+}
+
+// ------------------------------------------------------------
+// AVX2 kernels, 32 components per step
+// ------------------------------------------------------------
+__attribute__((target("avx2")))
+static void distanceL1Avx2(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	uint8_t padded[NEURON_SIZE] __attribute__((aligned(32))) = { 0 };
+	memcpy(padded, vector, length);
+	uint16_t blocks = length >> 5;
+	bool tail = (length & 31) != 0;
+	uint8_t tail_mask[32] __attribute__((aligned(32)));
+	for (uint16_t i = 0; i < 32; i++)
+		tail_mask[i] = (((length - 1) & 31) >= i) ? 0xFF : 0x00;
+	__m256i mask = _mm256_load_si256((const __m256i*)tail_mask);
+
+	for (uint32_t n = 0; n < count; n++) {
+		const __m256i* model = (const __m256i*)&models[n * NEURON_SIZE];
+		__m256i acc = _mm256_setzero_si256();
+		for (uint16_t b = 0; b < blocks; b++)
+			acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_load_si256(&model[b]), _mm256_load_si256((const __m256i*)&padded[b << 5])));
+		if (tail)
+			acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_and_si256(_mm256_load_si256(&model[blocks]), mask), _mm256_load_si256((const __m256i*)&padded[blocks << 5])));
+		__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+		dist[n] = (uint16_t)_mm_cvtsi128_si32(sum);
+	}
+}
+
+__attribute__((target("avx2")))
+static void distanceLsupAvx2(const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	uint8_t padded[NEURON_SIZE] __attribute__((aligned(32))) = { 0 };
+	memcpy(padded, vector, length);
+	uint16_t blocks = length >> 5;
+	bool tail = (length & 31) != 0;
+	uint8_t tail_mask[32] __attribute__((aligned(32)));
+	for (uint16_t i = 0; i < 32; i++)
+		tail_mask[i] = (((length - 1) & 31) >= i) ? 0xFF : 0x00;
+	__m256i mask = _mm256_load_si256((const __m256i*)tail_mask);
+
+	for (uint32_t n = 0; n < count; n++) {
+		const __m256i* model = (const __m256i*)&models[n * NEURON_SIZE];
+		__m256i acc = _mm256_setzero_si256();
+		for (uint16_t b = 0; b <= blocks; b++) {
+			if ((b == blocks) && !tail)
+				break;
+			__m256i m = _mm256_load_si256(&model[b]);
+			if (b == blocks)
+				m = _mm256_and_si256(m, mask);
+			__m256i v = _mm256_load_si256((const __m256i*)&padded[b << 5]);
+			acc = _mm256_max_epu8(acc, _mm256_or_si256(_mm256_subs_epu8(m, v), _mm256_subs_epu8(v, m)));
+		}
+		__m128i max = _mm_max_epu8(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		max = _mm_max_epu8(max, _mm_srli_si128(max, 8));
+		max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+		max = _mm_max_epu8(max, _mm_srli_si128(max, 2));
+		max = _mm_max_epu8(max, _mm_srli_si128(max, 1));
+		dist[n] = (uint16_t)(_mm_cvtsi128_si32(max) & 0x00FF);
+	}
+}
+
+#endif // NM500_DISTANCE_X86
+
+// ------------------------------------------------------------
+// Kernel selection at the first call
+// The kernels are picked into a local and published at once by the
+// initialization of a function-local static, which C++11 makes
+// thread-safe: no thread sees half a selection.
+// ------------------------------------------------------------
+struct DistanceKernels {
+	DistanceKernel l1;
+	DistanceKernel lsup;
+	const char* name;
+};
+
+static DistanceKernels selectKernels()
+{
+	DistanceKernels selected = { distanceL1Scalar, distanceLsupScalar, "scalar" };
+#if defined(NM500_DISTANCE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		selected.l1 = distanceL1Avx2;
+		selected.lsup = distanceLsupAvx2;
+		selected.name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		selected.l1 = distanceL1Sse2;
+		selected.lsup = distanceLsupSse2;
+		selected.name = "sse2";
+	}
+#endif
+	return (selected);
+}
+
+static const DistanceKernels& kernels()
+{
+	static const DistanceKernels selected = selectKernels();
+	return (selected);
+}
+
+void nm500Distance(bool lsup, const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[])
+{
+	const DistanceKernels& k = kernels();
+	if (length == 0) {
+		memset(dist, 0, count * sizeof(uint16_t));
+		return;
+	}
+	if (lsup)
+		k.lsup(vector, models, count, length, dist);
+	else
+		k.l1(vector, models, count, length, dist);
+}
+
+const char* nm500DistanceKernel()
+{
+	return (kernels().name);
+}
+
+#endif // NM500_EMULATOR
@@ -0,0 +1,53 @@
+/*
+ * NM500Distance.h - Distance kernels of the NM500 emulator
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NM500DISTANCE_H
+#define _NM500DISTANCE_H
+
+extern "C" {
+  #include <stdint.h>
+}
+
+#define NM500_MODEL_ALIGN	32		// alignment of the prototypes in byte
+
+// ------------------------------------------------------------
+// Distance of a vector to count prototypes laid out every NEURON_SIZE
+// bytes, starting on a NM500_MODEL_ALIGN boundary. Only the first
+// length components are compared, with the L1 norm (sum of the
+// absolute differences) or the Lsup norm (largest absolute difference)
+// as selected by GCR[7]. The kernel is chosen at the first call among
+// AVX2, SSE2 and scalar code, and all of them give the same result.
+// ------------------------------------------------------------
+void nm500Distance(bool lsup, const uint8_t* vector, const uint8_t* models, uint32_t count, uint16_t length, uint16_t dist[]);
+const char* nm500DistanceKernel();
+
+#endif // _NM500DISTANCE_H
@@ -0,0 +1,502 @@
+/*
+ * NM500Emulator.cpp - Software model of the NM500 for host builds
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NeuroShield.h>
+#include <NeuroShieldSPI.h>
+
+#if defined(NM500_EMULATOR)
+
+#include <NM500Emulator.h>
+#include <NM500Distance.h>
+
+extern "C" {
+  #include <stdint.h>
+  #include <string.h>
+}
+
+// ------------------------------------------------------------
+// Constructor, the neurons are cleared and uncommitted
+// ------------------------------------------------------------
+NM500Emulator::NM500Emulator(uint16_t neurons)
+{
+	total_neurons = neurons;
+	comp_alloc = new uint8_t[(uint32_t)neurons * NEURON_SIZE + NM500_MODEL_ALIGN];
+	comp = comp_alloc + ((NM500_MODEL_ALIGN - ((uintptr_t)comp_alloc % NM500_MODEL_ALIGN)) % NM500_MODEL_ALIGN);
+	ncr = new uint16_t[neurons];
+	aif = new uint16_t[neurons];
+	minif = new uint16_t[neurons];
+	cat = new uint16_t[neurons];
+	dist = new uint16_t[neurons];
+	output = new uint32_t[neurons];
+	memset(comp, 0, (uint32_t)neurons * NEURON_SIZE);
+	memset(ncr, 0, neurons * sizeof(uint16_t));
+	memset(minif, 0, neurons * sizeof(uint16_t));
+	memset(dist, 0xFF, neurons * sizeof(uint16_t));
+	memset(output, 0, neurons * sizeof(uint32_t));
+	broadcast_nbr = 0;
+	frame_pos = 0;
+	reset();
+}
+
+NM500Emulator::~NM500Emulator()
+{
+	delete[] comp_alloc;
+	delete[] ncr;
+	delete[] aif;
+	delete[] minif;
+	delete[] cat;
+	delete[] dist;
+	delete[] output;
+}
+
+// ------------------------------------------------------------
+// NM500 SW reset, the neuron memory is left as is
+// ------------------------------------------------------------
+void NM500Emulator::reset()
+{
+	for (uint16_t i = 0; i < total_neurons; i++) {
+		aif[i] = 0x4000;
+		cat[i] = 0;
+	}
+	ncount = 0;
+	gcr = 0x0001;
+	nsr = 0;
+	global_minif = 2;
+	global_maxif = 0x4000;
+	index = 0;
+	chain = 0;
+	memset(vector, 0, NEURON_SIZE);
+	length = 0;
+	status = 0;
+	best = 0xFFFF;
+	readout = 0xFFFF;
+	readout_started = 0;
+}
+
+// ------------------------------------------------------------
+// SPI slave side
+// A frame starts at the falling edge of the slave select with an
+// 8-byte header (dummy ID, addr[31:0], word count[23:0]) followed by
+// 2 bytes per word. Read data is shifted out MSB first.
+// ------------------------------------------------------------
+void NM500Emulator::select()
+{
+	frame_pos = 0;
+	frames++;
+}
+
+void NM500Emulator::deselect()
+{
+	frame_pos = 0;
+}
+
+void NM500Emulator::transfer(uint8_t* data, uint16_t size)
+{
+	bytes += size;
+	for (uint16_t i = 0; i < size; i++) {
+		uint8_t in = data[i];
+		uint8_t out = 0;
+		if (frame_pos < 8) {
+			frame[frame_pos] = in;
+			if (frame_pos == 7)
+				frame_words = ((uint32_t)frame[5] << 16) | ((uint32_t)frame[6] << 8) | frame[7];
+		} else if (((frame_pos - 8) >> 1) < frame_words) {
+			uint8_t module = frame[1] & 0x7F;
+			if (frame[1] & 0x80) {
+				if ((frame_pos & 1) == 0) {
+					frame_data = (uint16_t)(in << 8);
+				} else {
+					frame_data |= in;
+					write(module, frame[4], frame_data);
+				}
+			} else {
+				if ((frame_pos & 1) == 0) {
+					frame_data = read(module, frame[4]);
+					out = (uint8_t)(frame_data >> 8);
+				} else {
+					out = (uint8_t)(frame_data & 0x00FF);
+				}
+			}
+		}
+		data[i] = out;
+		frame_pos++;
+	}
+}
+
+// ------------------------------------------------------------
+// Register access of a module
+// ------------------------------------------------------------
+uint16_t NM500Emulator::read(uint8_t module, uint8_t reg)
+{
+	if (module == NeuroShieldSPI::module_fpga) {
+		if (reg == 1)
+			return (fpga_version);
+		return (0);
+	}
+	if (module != NeuroShieldSPI::module_nm500)
+		return (0);
+	if (nsr & 0x0010)
+		return (readSR(reg));
+	return (readNormal(reg));
+}
+
+void NM500Emulator::write(uint8_t module, uint8_t reg, uint16_t data)
+{
+	if (module == NeuroShieldSPI::module_fpga) {
+		if (reg == 2)
+			reset();
+		return;
+	}
+	if (module != NeuroShieldSPI::module_nm500)
+		return;
+	if (nsr & 0x0010)
+		writeSR(reg, data);
+	else
+		writeNormal(reg, data);
+}
+
+// ------------------------------------------------------------
+// A neuron takes part in the recognition if it is committed and its
+// context matches the global context, context 0 selects all neurons
+// ------------------------------------------------------------
+bool NM500Emulator::inContext(uint16_t n)
+{
+	uint16_t context = gcr & 0x007F;
+	return ((context == 0) || ((ncr[n] & 0x007F) == context));
+}
+
+// ------------------------------------------------------------
+// Compute the distance of the committed neurons to the vector
+// and the recognition status
+// ------------------------------------------------------------
+void NM500Emulator::recognize()
+{
+	bool lsup = (gcr & 0x0080) != 0;
+	bool knn = (nsr & 0x0020) != 0;
+	uint16_t first_cat = 0xFFFF;
+
+	broadcast_nbr++;
+	status = 0;
+	best = 0xFFFF;
+	readout = 0xFFFF;
+	readout_started = 0;
+	nm500Distance(lsup, vector, comp, ncount, length, dist);
+	for (uint16_t n = 0; n < ncount; n++) {
+		if (!inContext(n)) {
+			dist[n] = 0xFFFF;
+			continue;
+		}
+		uint16_t d = dist[n];
+		if (!knn && (d >= aif[n]))
+			continue;
+		if ((best == 0xFFFF) || (d < dist[best]) || ((d == dist[best]) && (cat[n] < cat[best])))
+			best = n;
+		if (first_cat == 0xFFFF)
+			first_cat = cat[n] & 0x7FFF;
+		else if ((cat[n] & 0x7FFF) != first_cat)
+			status = 0x0004;
+	}
+	if ((best != 0xFFFF) && (status == 0))
+		status = 0x0008;
+}
+
+// ------------------------------------------------------------
+// Learn the last broadcast vector with a category
+// The firing neurons of another category shrink their AIF to their
+// distance. A new neuron is committed unless a firing neuron already
+// has the category, with an AIF set to the distance of the closest
+// neuron of another category and at most MAXIF. A neuron whose AIF
+// reaches MINIF is degenerated (CAT[15]).
+// Category 0 only shrinks the firing neurons.
+// ------------------------------------------------------------
+void NM500Emulator::learn(uint16_t category)
+{
+	bool knn = (nsr & 0x0020) != 0;
+	bool recognized = false;
+	uint16_t new_aif = global_maxif;
+
+	for (uint16_t n = 0; n < ncount; n++) {
+		if (dist[n] == 0xFFFF)
+			continue;
+		bool firing = knn || (dist[n] < aif[n]);
+		if ((cat[n] & 0x7FFF) == category) {
+			if (firing)
+				recognized = true;
+			continue;
+		}
+		if (dist[n] < new_aif)
+			new_aif = dist[n];
+		if (firing) {
+			aif[n] = dist[n];
+			if (aif[n] <= minif[n]) {
+				aif[n] = minif[n];
+				cat[n] |= 0x8000;
+			}
+		}
+	}
+	if ((category == 0) || recognized || (ncount >= total_neurons))
+		return;
+
+	uint16_t n = ncount++;
+	memcpy(&comp[(uint32_t)n * NEURON_SIZE], vector, length);
+	ncr[n] = gcr & 0x00FF;
+	minif[n] = global_minif;
+	cat[n] = category;
+	aif[n] = new_aif;
+	if (new_aif <= global_minif) {
+		aif[n] = global_minif;
+		cat[n] |= 0x8000;
+	}
+	dist[n] = 0xFFFF;
+}
+
+// ------------------------------------------------------------
+// Move the readout to the next firing neuron, 0xFFFF if none
+// ------------------------------------------------------------
+uint16_t NM500Emulator::nextReadout()
+{
+	if (readout_started == 0) {
+		readout_started = 1;
+		readout = best;
+	} else {
+		bool knn = (nsr & 0x0020) != 0;
+		readout = 0xFFFF;
+		for (uint16_t n = 0; n < ncount; n++) {
+			if ((dist[n] == 0xFFFF) || (output[n] == broadcast_nbr))
+				continue;
+			if (!knn && (dist[n] >= aif[n]))
+				continue;
+			if ((readout == 0xFFFF) || (dist[n] < dist[readout]) || ((dist[n] == dist[readout]) && (cat[n] < cat[readout])))
+				readout = n;
+		}
+	}
+	if (readout != 0xFFFF)
+		output[readout] = broadcast_nbr;
+	return (readout);
+}
+
+// ------------------------------------------------------------
+// Normal mode (learning and recognition)
+// ------------------------------------------------------------
+uint16_t NM500Emulator::readNormal(uint8_t reg)
+{
+	switch (reg) {
+		case NM_DIST:
+			if (nextReadout() == 0xFFFF)
+				return (0xFFFF);
+			return (dist[readout]);
+		case NM_CAT:
+			if (readout_started == 0)
+				nextReadout();
+			return ((readout == 0xFFFF) ? 0xFFFF : cat[readout]);
+		case NM_NID:
+			if (readout_started == 0)
+				nextReadout();
+			return ((readout == 0xFFFF) ? 0 : (readout + 1));
+		case NM_AIF:
+			return ((readout == 0xFFFF) ? 0xFFFF : aif[readout]);
+		case NM_NCR:
+			return ((readout == 0xFFFF) ? 0 : ncr[readout]);
+		case NM_COMP:
+			return ((index < NEURON_SIZE) ? vector[index++] : 0);
+		case NM_MINIF:
+			return (global_minif);
+		case NM_MAXIF:
+			return (global_maxif);
+		case NM_GCR:
+			return (gcr);
+		case NM_NSR:
+			return (nsr | status);
+		case NM_NCOUNT:
+			return (ncount);
+		default:
+			return (0);
+	}
+}
+
+void NM500Emulator::writeNormal(uint8_t reg, uint16_t data)
+{
+	switch (reg) {
+		case NM_COMP:
+			if (index < NEURON_SIZE)
+				vector[index++] = (uint8_t)data;
+			break;
+		case NM_LCOMP:
+			if (index < NEURON_SIZE)
+				vector[index++] = (uint8_t)data;
+			length = index;
+			index = 0;
+			recognize();
+			break;
+		case NM_INDEXCOMP:
+			index = data;
+			break;
+		case NM_CAT:
+			learn(data);
+			break;
+		case NM_MINIF:
+			global_minif = data;
+			break;
+		case NM_MAXIF:
+			global_maxif = data;
+			break;
+		case NM_TESTCOMP:
+			if (index < NEURON_SIZE)
+				for (uint16_t n = 0; n < total_neurons; n++)
+					comp[(uint32_t)n * NEURON_SIZE + index] = (uint8_t)data;
+			break;
+		case NM_TESTCAT:
+			for (uint16_t n = 0; n < total_neurons; n++)
+				cat[n] = data;
+			break;
+		case NM_GCR:
+			gcr = data;
+			break;
+		case NM_RSTCHAIN:
+			chain = 0;
+			index = 0;
+			break;
+		case NM_NSR:
+			nsr = data & 0x00F3;
+			index = 0;
+			break;
+		case NM_FORGET:
+			for (uint16_t n = 0; n < total_neurons; n++)
+				cat[n] = 0;
+			ncount = 0;
+			index = 0;
+			gcr = 0x0001;
+			global_minif = 2;
+			global_maxif = 0x4000;
+			status = 0;
+			best = 0xFFFF;
+			readout = 0xFFFF;
+			break;
+		default:
+			break;
+	}
+}
+
+// ------------------------------------------------------------
+// Save and Restore mode, registers access the neuron pointed by the
+// chain. Reading or writing CAT moves to the next neuron.
+// ------------------------------------------------------------
+uint16_t NM500Emulator::readSR(uint8_t reg)
+{
+	if (chain >= total_neurons)
+		return (0xFFFF);
+	switch (reg) {
+		case NM_NCR:
+			return (ncr[chain]);
+		case NM_COMP:
+			return ((index < NEURON_SIZE) ? comp[(uint32_t)chain * NEURON_SIZE + index++] : 0);
+		case NM_AIF:
+			return (aif[chain]);
+		case NM_MINIF:
+			return (minif[chain]);
+		case NM_CAT: {
+			uint16_t value = cat[chain];
+			chain++;
+			index = 0;
+			return (value);
+		}
+		case NM_NID:
+			return (chain + 1);
+		case NM_GCR:
+			return (gcr);
+		case NM_NSR:
+			return (nsr);
+		case NM_NCOUNT:
+			return (ncount);
+		default:
+			return (0xFFFF);
+	}
+}
+
+void NM500Emulator::writeSR(uint8_t reg, uint16_t data)
+{
+	switch (reg) {
+		case NM_NSR:
+			nsr = data & 0x00F3;
+			index = 0;
+			return;
+		case NM_RSTCHAIN:
+			chain = 0;
+			index = 0;
+			return;
+		case NM_FORGET:
+			writeNormal(reg, data);
+			return;
+		case NM_GCR:
+			gcr = data;
+			return;
+		case NM_INDEXCOMP:
+			index = data;
+			return;
+		case NM_TESTCOMP:
+		case NM_TESTCAT:
+			writeNormal(reg, data);
+			return;
+		default:
+			break;
+	}
+	if (chain >= total_neurons)
+		return;
+	switch (reg) {
+		case NM_NCR:
+			ncr[chain] = data;
+			break;
+		case NM_COMP:
+			if (index < NEURON_SIZE)
+				comp[(uint32_t)chain * NEURON_SIZE + index++] = (uint8_t)data;
+			break;
+		case NM_AIF:
+			aif[chain] = data;
+			break;
+		case NM_MINIF:
+			minif[chain] = data;
+			break;
+		case NM_CAT:
+			cat[chain] = data;
+			if ((chain == ncount) && (data != 0)) {
+				dist[chain] = 0xFFFF;
+				ncount++;
+			}
+			chain++;
+			index = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+#endif // NM500_EMULATOR
@@ -0,0 +1,130 @@
+/*
+ * NM500Emulator.h - Software model of the NM500 for host builds
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NM500EMULATOR_H
+#define _NM500EMULATOR_H
+
+#include <NeuroShield.h>
+
+extern "C" {
+  #include <stdint.h>
+}
+
+#define NM500_NEURONS		576		// number of neurons of one NM500 chip
+#define NM500_EMU_VERSION	0x0003	// FPGA version reported by the emulator (burst-read capable)
+
+// ------------------------------------------------------------
+// NM500Emulator
+// Behaves as the NeuroShield FPGA + NM500 on the other side of the SPI
+// bus. NeuroShieldSPI hands it the frames it would put on the wire and
+// it decodes them into the register semantics used by the library:
+// - COMP/LCOMP broadcast, L1 or Lsup norm selected by GCR[7]
+// - CAT write learns: AIF shrinking of the firing neurons of another
+//   category, commit of a new neuron, degenerated flag at MINIF
+// - DIST/CAT/NID readout by increasing distance, then category,
+//   then position in the chain
+// - NSR UNC/ID status and SR/KNN mode bits, GCR context
+// - SR-mode access through RSTCHAIN, TESTCOMP/TESTCAT, FORGET
+// ------------------------------------------------------------
+class NM500Emulator
+{
+	public:
+		NM500Emulator(uint16_t neurons = NM500_NEURONS);
+		~NM500Emulator();
+		
+		// SPI slave side: slave select edges and in-place byte exchange
+		void select();
+		void deselect();
+		void transfer(uint8_t* data, uint16_t size);
+		
+		// register access of a module (module + reg = addr)
+		uint16_t read(uint8_t module, uint8_t reg);
+		void write(uint8_t module, uint8_t reg, uint16_t data);
+		
+		void reset();
+		
+		uint16_t total_neurons;
+		uint16_t fpga_version = NM500_EMU_VERSION;
+		
+		// bus activity, to model the time the frames take on a real SPI link
+		uint32_t frames = 0;			// slave select falling edges
+		uint32_t bytes = 0;				// bytes clocked
+		
+	private:
+		NM500Emulator(const NM500Emulator&);
+		NM500Emulator& operator=(const NM500Emulator&);
+		
+		// neuron store, one array per field
+		uint8_t* comp;					// total_neurons * NEURON_SIZE, aligned prototypes
+		uint8_t* comp_alloc;
+		uint16_t* ncr;
+		uint16_t* aif;
+		uint16_t* minif;
+		uint16_t* cat;
+		uint16_t ncount;
+		
+		// global registers
+		uint16_t gcr;
+		uint16_t nsr;					// mode bits, the status bits are in status
+		uint16_t global_minif;
+		uint16_t global_maxif;
+		uint16_t index;					// component index
+		uint16_t chain;					// neuron pointed in SR-mode
+		
+		// last broadcast vector and its recognition
+		uint8_t vector[NEURON_SIZE];
+		uint16_t length;
+		uint16_t* dist;					// distance of the neurons, 0xFFFF if out of context
+		uint32_t* output;				// broadcast number at which a neuron was read out
+		uint32_t broadcast_nbr;
+		uint16_t status;
+		uint16_t best;					// first neuron of the readout, 0xFFFF if none
+		uint16_t readout;				// neuron pointed by the last readout
+		uint8_t readout_started;
+		
+		// frame decoder
+		uint8_t frame[8];
+		uint32_t frame_pos;
+		uint32_t frame_words;
+		uint16_t frame_data;
+		
+		bool inContext(uint16_t n);
+		void recognize();
+		void learn(uint16_t category);
+		uint16_t nextReadout();
+		uint16_t readNormal(uint8_t reg);
+		void writeNormal(uint8_t reg, uint16_t data);
+		uint16_t readSR(uint8_t reg);
+		void writeSR(uint8_t reg, uint16_t data);
+};
+
+#endif // _NM500EMULATOR_H
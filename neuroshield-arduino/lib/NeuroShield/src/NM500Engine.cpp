@@ -0,0 +1,632 @@
+/*
+ * NM500Engine.cpp - Multithreaded host NeuroMem engine
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NM500Engine.h>
+
+#if !defined(ARDUINO)
+
+#include <NM500Distance.h>
+
+#include <atomic>
+
+extern "C" {
+  #include <stdint.h>
+  #include <string.h>
+}
+
+// ------------------------------------------------------------
+// Pool of workers, the calling thread of run() is the worker 0
+// ------------------------------------------------------------
+NM500Pool::NM500Pool(unsigned count)
+{
+	if (count == 0)
+		count = std::thread::hardware_concurrency();
+	if (count == 0)
+		count = 1;
+	workers = count;
+	slices = new Slice[count];
+	for (unsigned w = 1; w < count; w++)
+		threads.emplace_back(&NM500Pool::loop, this, w);
+}
+
+NM500Pool::~NM500Pool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	start.notify_all();
+	for (std::thread& thread : threads)
+		thread.join();
+	delete[] slices;
+}
+
+unsigned NM500Pool::size()
+{
+	return (workers);
+}
+
+// ------------------------------------------------------------
+// Run job(worker, task) for the tasks 0..count-1 and return when
+// all of them are done
+// ------------------------------------------------------------
+void NM500Pool::run(uint32_t count, const Job& fn)
+{
+	if ((workers == 1) || (count <= 1)) {
+		for (uint32_t task = 0; task < count; task++)
+			fn(0, task);
+		return;
+	}
+	for (unsigned w = 0; w < workers; w++) {
+		slices[w].first = (uint32_t)(((uint64_t)count * w) / workers);
+		slices[w].last = (uint32_t)(((uint64_t)count * (w + 1)) / workers);
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job = &fn;
+		active = workers - 1;
+		generation++;
+	}
+	start.notify_all();
+	work(0);
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this] { return (active == 0); });
+	job = nullptr;
+}
+
+void NM500Pool::loop(unsigned worker)
+{
+	uint32_t seen = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			start.wait(guard, [&] { return (stop || (generation != seen)); });
+			if (stop)
+				return;
+			seen = generation;
+		}
+		work(worker);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (--active == 0)
+				done.notify_one();
+		}
+	}
+}
+
+void NM500Pool::work(unsigned worker)
+{
+	uint32_t task;
+
+	while (next(worker, &task))
+		(*job)(worker, task);
+}
+
+// ------------------------------------------------------------
+// Take the next task of the slice of the worker, or steal the back
+// half of the first other slice which is not empty
+// ------------------------------------------------------------
+bool NM500Pool::next(unsigned worker, uint32_t* task)
+{
+	Slice& own = slices[worker];
+	{
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (own.first < own.last) {
+			*task = own.first++;
+			return (true);
+		}
+	}
+	for (unsigned i = 1; i < workers; i++) {
+		Slice& victim = slices[(worker + i) % workers];
+		uint32_t first, last;
+		{
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (victim.first == victim.last)
+				continue;
+			last = victim.last;
+			first = last - (last - victim.first + 1) / 2;
+			victim.last = first;
+		}
+		{
+			std::lock_guard<std::mutex> guard(own.lock);
+			own.first = first + 1;
+			own.last = last;
+		}
+		*task = first;
+		return (true);
+	}
+	return (false);
+}
+
+// ------------------------------------------------------------
+// Order of the responses: distance, then category, then identifier
+// ------------------------------------------------------------
+static inline bool respondsBefore(uint16_t dist, uint16_t cat, uint16_t nid, const NeuroShield::Result& r)
+{
+	if (dist != r.dist)
+		return (dist < r.dist);
+	if (cat != r.cat)
+		return (cat < r.cat);
+	return (nid < r.nid);
+}
+
+// components past NEURON_SIZE are ignored, as by the chip
+static inline uint16_t clampLength(uint16_t length)
+{
+	return ((length > NEURON_SIZE) ? NEURON_SIZE : length);
+}
+
+// ------------------------------------------------------------
+// Constructor, no neuron is committed and the registers have their
+// value after a forget(). threads=0 uses one worker per core.
+// ------------------------------------------------------------
+NM500Engine::NM500Engine(uint16_t neurons, unsigned threads)
+	: pool(threads), dist((size_t)pool.size() * NM500_ENGINE_SHARD)
+{
+	total_neurons = (neurons > NM500_ENGINE_MAX_NEURONS) ? NM500_ENGINE_MAX_NEURONS : neurons;
+}
+
+NM500Engine::~NM500Engine()
+{
+	for (Shard* shard : shards) {
+		delete[] shard->comp_alloc;
+		delete shard;
+	}
+}
+
+unsigned NM500Engine::threadCount()
+{
+	return (pool.size());
+}
+
+uint16_t NM500Engine::getNcount()
+{
+	return (ncount);
+}
+
+// ------------------------------------------------------------
+// Un-commit all the neurons and set the registers back to their
+// default (context 1, L1 norm, MINIF 2, MAXIF 0x4000 or maxif)
+// The classifier mode is kept, as by the FORGET command.
+// ------------------------------------------------------------
+void NM500Engine::forget()
+{
+	for (Shard* shard : shards)
+		shard->ncount = 0;
+	ncount = 0;
+	gcr = 0x0001;
+	global_minif = 2;
+	global_maxif = 0x4000;
+}
+
+void NM500Engine::forget(uint16_t maxif)
+{
+	forget();
+	global_maxif = maxif;
+}
+
+// ------------------------------------------------------------
+// GCR[7]= Norm (0 for L1; 1 for LSup), GCR[6-0]= context
+// ------------------------------------------------------------
+void NM500Engine::setGcr(uint16_t value)
+{
+	gcr = value;
+}
+
+uint16_t NM500Engine::getGcr()
+{
+	return (gcr);
+}
+
+void NM500Engine::setContext(uint8_t context)
+{
+	gcr = (gcr & 0xFF80) | (context & 0x007F);
+}
+
+void NM500Engine::setContext(uint8_t context, uint16_t minif, uint16_t maxif)
+{
+	setContext(context);
+	global_minif = minif;
+	global_maxif = maxif;
+}
+
+void NM500Engine::getContext(uint8_t* context, uint16_t* minif, uint16_t* maxif)
+{
+	*context = (uint8_t)(gcr & 0x007F);
+	*minif = global_minif;
+	*maxif = global_maxif;
+}
+
+void NM500Engine::setRbfClassifier()
+{
+	nsr &= ~0x0020;
+}
+
+void NM500Engine::setKnnClassifier()
+{
+	nsr |= 0x0020;
+}
+
+// ------------------------------------------------------------
+// A neuron takes part in the recognition if its context matches the
+// global context, context 0 selects all neurons
+// ------------------------------------------------------------
+bool NM500Engine::inContext(uint16_t ncr)
+{
+	uint16_t context = gcr & 0x007F;
+	return ((context == 0) || ((ncr & 0x007F) == context));
+}
+
+uint16_t* NM500Engine::workerDist(unsigned worker)
+{
+	return (&dist[(size_t)worker * NM500_ENGINE_SHARD]);
+}
+
+uint32_t NM500Engine::activeShards()
+{
+	return ((ncount + NM500_ENGINE_SHARD - 1) / NM500_ENGINE_SHARD);
+}
+
+// ------------------------------------------------------------
+// Add the firing neurons of a shard to the responses to a vector
+// ------------------------------------------------------------
+void NM500Engine::scan(const Shard& shard, const uint8_t* vector, uint16_t length, uint16_t* dist, Response& response)
+{
+	bool lsup = (gcr & 0x0080) != 0;
+	bool knn = (nsr & 0x0020) != 0;
+
+	nm500Distance(lsup, vector, shard.comp, shard.ncount, length, dist);
+	for (uint16_t n = 0; n < shard.ncount; n++) {
+		if (!inContext(shard.ncr[n]))
+			continue;
+		uint16_t d = dist[n];
+		if (!knn && (d >= shard.aif[n]))
+			continue;
+		uint16_t cat = shard.cat[n] & 0x7FFF;
+		if (response.first_cat == 0xFFFF)
+			response.first_cat = cat;
+		else if (cat != response.first_cat)
+			response.uncertain = true;
+		insert(response, d, shard.cat[n], shard.first + n + 1);
+	}
+}
+
+// ------------------------------------------------------------
+// Keep a firing neuron if it is among the k first responses
+// ------------------------------------------------------------
+void NM500Engine::insert(Response& response, uint16_t dist, uint16_t cat, uint16_t nid)
+{
+	Result* top = response.top;
+	uint16_t k = response.k;
+
+	if (k == 0)
+		return;
+	if ((response.count == k) && !respondsBefore(dist, cat, nid, top[k - 1]))
+		return;
+	uint16_t pos = (response.count < k) ? response.count++ : (k - 1);
+	while ((pos > 0) && respondsBefore(dist, cat, nid, top[pos - 1])) {
+		top[pos] = top[pos - 1];
+		pos--;
+	}
+	top[pos].dist = dist;
+	top[pos].cat = cat;
+	top[pos].nid = nid;
+}
+
+// ------------------------------------------------------------
+// Merge the responses of a shard into the responses to the vector
+// ------------------------------------------------------------
+void NM500Engine::merge(Response& response, const Response& part)
+{
+	if (part.first_cat == 0xFFFF)
+		return;
+	if (response.first_cat == 0xFFFF)
+		response.first_cat = part.first_cat;
+	else if (part.first_cat != response.first_cat)
+		response.uncertain = true;
+	if (part.uncertain)
+		response.uncertain = true;
+	for (uint16_t i = 0; i < part.count; i++)
+		insert(response, part.top[i].dist, part.top[i].cat, part.top[i].nid);
+}
+
+// ------------------------------------------------------------
+// NSR of a vector: 0=unknown, 4=uncertain, 8=identified, and the
+// KNN mode bit. The responses past the last firing neuron are 0xFFFF.
+// ------------------------------------------------------------
+uint16_t NM500Engine::finish(Response& response)
+{
+	uint16_t status = nsr;
+
+	if (response.first_cat != 0xFFFF)
+		status |= response.uncertain ? 0x0004 : 0x0008;
+	for (uint16_t i = 0; i < response.k; i++) {
+		Result& r = response.top[i];
+		r.status = status;
+		if (i >= response.count) {
+			r.dist = 0xFFFF;
+			r.cat = 0xFFFF;
+			r.nid = 0xFFFF;
+		}
+	}
+	return (status);
+}
+
+// ------------------------------------------------------------
+// Responses to a vector, the shards are scanned by the workers and
+// their k first responses merged
+// ------------------------------------------------------------
+void NM500Engine::recognize(const uint8_t* vector, uint16_t length, Response& response)
+{
+	uint32_t count = activeShards();
+
+	if (count <= 1) {
+		if (count == 1)
+			scan(*shards[0], vector, length, workerDist(0), response);
+		return;
+	}
+	std::vector<Result> top((size_t)count * response.k);
+	std::vector<Response> parts(count);
+	for (uint32_t s = 0; s < count; s++)
+		parts[s] = { top.data() + (size_t)s * response.k, response.k, 0, 0xFFFF, false };
+	pool.run(count, [&](unsigned worker, uint32_t s) {
+		scan(*shards[s], vector, length, workerDist(worker), parts[s]);
+	});
+	for (uint32_t s = 0; s < count; s++)
+		merge(response, parts[s]);
+}
+
+//-----------------------------------------------
+// Learn a vector using the current context value, as the chip
+// The firing neurons of another category shrink their AIF to their
+// distance. A new neuron is committed unless a firing neuron already
+// has the category, with an AIF set to the distance of the closest
+// neuron of another category and at most MAXIF. Category 0 only
+// shrinks the firing neurons.
+// Return the number of committed neurons
+//----------------------------------------------
+uint16_t NM500Engine::learn(const uint8_t* vector, uint16_t length, uint16_t category)
+{
+	uint32_t count = activeShards();
+	std::vector<LearnResponse> parts(count);
+
+	length = clampLength(length);
+	pool.run(count, [&](unsigned worker, uint32_t s) {
+		learnShard(*shards[s], vector, length, category, workerDist(worker), parts[s]);
+	});
+
+	bool recognized = false;
+	uint16_t aif = global_maxif;
+	for (uint32_t s = 0; s < count; s++) {
+		if (parts[s].recognized)
+			recognized = true;
+		if (parts[s].closest < aif)
+			aif = parts[s].closest;
+	}
+	if ((category == 0) || recognized || (ncount >= total_neurons))
+		return (ncount);
+
+	uint16_t cat = category;
+	if (aif <= global_minif) {
+		aif = global_minif;
+		cat |= 0x8000;
+	}
+	commit(vector, length, gcr & 0x00FF, aif, global_minif, cat);
+	return (ncount);
+}
+
+void NM500Engine::learnShard(Shard& shard, const uint8_t* vector, uint16_t length, uint16_t category, uint16_t* dist, LearnResponse& response)
+{
+	bool lsup = (gcr & 0x0080) != 0;
+	bool knn = (nsr & 0x0020) != 0;
+
+	response.recognized = false;
+	response.closest = 0xFFFF;
+	nm500Distance(lsup, vector, shard.comp, shard.ncount, length, dist);
+	for (uint16_t n = 0; n < shard.ncount; n++) {
+		if (!inContext(shard.ncr[n]))
+			continue;
+		uint16_t d = dist[n];
+		bool firing = knn || (d < shard.aif[n]);
+		if ((shard.cat[n] & 0x7FFF) == category) {
+			if (firing)
+				response.recognized = true;
+			continue;
+		}
+		if (d < response.closest)
+			response.closest = d;
+		if (firing) {
+			shard.aif[n] = d;
+			if (shard.aif[n] <= shard.minif[n]) {
+				shard.aif[n] = shard.minif[n];
+				shard.cat[n] |= 0x8000;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------
+// Learn count vectors stored one after the other (count * length
+// bytes), the vector i with categories[i], using the current context
+// Return the number of committed neurons
+//----------------------------------------------
+uint16_t NM500Engine::learnBatch(const uint8_t* vectors, uint32_t count, uint16_t length, const uint16_t categories[])
+{
+	for (uint32_t i = 0; i < count; i++) {
+		learn(vectors, length, categories[i]);
+		vectors += length;
+	}
+	return (ncount);
+}
+
+// --------------------------------------------------------
+// Recognize a vector and return the recognition status
+// 0=unknown, 4=uncertain, 8=Identified
+//---------------------------------------------------------
+uint16_t NM500Engine::classify(const uint8_t* vector, uint16_t length)
+{
+	Response response = { nullptr, 0, 0, 0xFFFF, false };
+
+	recognize(vector, clampLength(length), response);
+	return (finish(response));
+}
+
+//----------------------------------------------
+// Recognize a vector and return the response of up to K top firing
+// neurons in results, all with the classification status
+// Return the number of firing neurons or K whichever is smaller
+//----------------------------------------------
+uint16_t NM500Engine::classify(const uint8_t* vector, uint16_t length, uint16_t k, Result results[])
+{
+	Response response = { results, k, 0, 0xFFFF, false };
+
+	recognize(vector, clampLength(length), response);
+	finish(response);
+	return (response.count);
+}
+
+//----------------------------------------------
+// Recognize count vectors stored one after the other (count * length
+// bytes), with the response of the top firing neuron of the vector i
+// in out[i], or k responses per vector in out[i * k]..out[i * k + k - 1]
+// Return the number of vectors with a firing neuron
+//----------------------------------------------
+uint32_t NM500Engine::classifyBatch(const uint8_t* vectors, uint32_t count, uint16_t length, Result* out)
+{
+	return (classifyBatch(vectors, count, length, 1, out));
+}
+
+uint32_t NM500Engine::classifyBatch(const uint8_t* vectors, uint32_t count, uint16_t length, uint16_t k, Result* out)
+{
+	uint32_t tasks = (count + NM500_ENGINE_CHUNK - 1) / NM500_ENGINE_CHUNK;
+	uint32_t active = activeShards();
+	uint16_t stride = length;
+	std::atomic<uint32_t> recog_nbr(0);
+
+	length = clampLength(length);
+	pool.run(tasks, [&](unsigned worker, uint32_t task) {
+		Response responses[NM500_ENGINE_CHUNK];
+		uint32_t first = task * NM500_ENGINE_CHUNK;
+		uint32_t size = ((count - first) < NM500_ENGINE_CHUNK) ? (count - first) : NM500_ENGINE_CHUNK;
+		uint32_t found = 0;
+
+		for (uint32_t i = 0; i < size; i++)
+			responses[i] = { &out[(size_t)(first + i) * k], k, 0, 0xFFFF, false };
+		for (uint32_t s = 0; s < active; s++) {
+			for (uint32_t i = 0; i < size; i++)
+				scan(*shards[s], &vectors[(size_t)(first + i) * stride], length, workerDist(worker), responses[i]);
+		}
+		for (uint32_t i = 0; i < size; i++) {
+			finish(responses[i]);
+			if (responses[i].first_cat != 0xFFFF)
+				found++;
+		}
+		recog_nbr += found;
+	});
+	return (recog_nbr);
+}
+
+//-------------------------------------------------------------
+// Read the first length components of a neuron, in an array of
+// (length + 4) words: NCR, length * COMP, AIF, MINIF, CAT
+// All words are 0xFFFF if the neuron is not committed
+//-------------------------------------------------------------
+void NM500Engine::readNeuron(uint16_t nid, uint16_t neuron[], uint16_t length)
+{
+	length = clampLength(length);
+	if ((nid == 0) || (nid > ncount)) {
+		for (int i = 0; i < (length + 4); i++)
+			neuron[i] = 0xFFFF;
+		return;
+	}
+	const Shard& shard = *shards[(nid - 1) / NM500_ENGINE_SHARD];
+	uint16_t n = (nid - 1) % NM500_ENGINE_SHARD;
+	const uint8_t* comp = &shard.comp[(uint32_t)n * NEURON_SIZE];
+	neuron[0] = shard.ncr[n];
+	for (uint16_t i = 0; i < length; i++)
+		neuron[i + 1] = comp[i];
+	neuron[length + 1] = shard.aif[n];
+	neuron[length + 2] = shard.minif[n];
+	neuron[length + 3] = shard.cat[n];
+}
+
+//-------------------------------------------------------------
+// Replace the neurons with ncount records of (length + 4) words in the
+// format of readNeuron(), the registers are left as is
+//-------------------------------------------------------------
+void NM500Engine::writeNeurons(const uint16_t* neurons, uint16_t count, uint16_t length)
+{
+	uint8_t comp[NEURON_SIZE];
+
+	length = clampLength(length);
+	for (Shard* shard : shards)
+		shard->ncount = 0;
+	ncount = 0;
+	if (count > total_neurons)
+		count = total_neurons;
+	for (uint16_t i = 0; i < count; i++) {
+		for (uint16_t j = 0; j < length; j++)
+			comp[j] = (uint8_t)neurons[j + 1];
+		commit(comp, length, neurons[0], neurons[length + 1], neurons[length + 2], neurons[length + 3]);
+		neurons += length + 4;
+	}
+}
+
+// ------------------------------------------------------------
+// Commit a neuron after the last one, the components past length are 0
+// ------------------------------------------------------------
+void NM500Engine::commit(const uint8_t* vector, uint16_t length, uint16_t ncr, uint16_t aif, uint16_t minif, uint16_t cat)
+{
+	uint32_t s = ncount / NM500_ENGINE_SHARD;
+
+	if (s == shards.size()) {
+		Shard* shard = new Shard;
+		shard->comp_alloc = new uint8_t[NM500_ENGINE_SHARD * NEURON_SIZE + NM500_MODEL_ALIGN];
+		shard->comp = shard->comp_alloc + ((NM500_MODEL_ALIGN - ((uintptr_t)shard->comp_alloc % NM500_MODEL_ALIGN)) % NM500_MODEL_ALIGN);
+		shard->first = ncount;
+		shard->ncount = 0;
+		shards.push_back(shard);
+	}
+	Shard& shard = *shards[s];
+	uint16_t n = shard.ncount++;
+	uint8_t* comp = &shard.comp[(uint32_t)n * NEURON_SIZE];
+	memcpy(comp, vector, length);
+	memset(&comp[length], 0, NEURON_SIZE - length);
+	shard.ncr[n] = ncr;
+	shard.aif[n] = aif;
+	shard.minif[n] = minif;
+	shard.cat[n] = cat;
+	ncount++;
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,212 @@
+/*
+ * NM500Engine.h - Multithreaded host NeuroMem engine
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NM500ENGINE_H
+#define _NM500ENGINE_H
+
+#include <NeuroShield.h>
+
+#if !defined(ARDUINO)
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include <stdint.h>
+}
+
+// neurons of a shard (256 KB of prototypes)
+#ifndef NM500_ENGINE_SHARD
+#define NM500_ENGINE_SHARD		1024
+#endif
+
+// vectors of a task of classifyBatch()
+#ifndef NM500_ENGINE_CHUNK
+#define NM500_ENGINE_CHUNK		16
+#endif
+
+#define NM500_ENGINE_MAX_NEURONS	0xFFFE	// neuron identifiers stay below 0xFFFF
+
+// ------------------------------------------------------------
+// NM500Pool
+// Fixed set of worker threads running the tasks 0..count-1 of a job.
+// Each worker starts with an equal slice of the tasks and takes them
+// from the front, a worker whose slice is empty steals the back half
+// of the slice of another one. The calling thread is the worker 0.
+// ------------------------------------------------------------
+class NM500Pool
+{
+	public:
+		typedef std::function<void(unsigned worker, uint32_t task)> Job;
+		
+		NM500Pool(unsigned threads);
+		~NM500Pool();
+		
+		unsigned size();
+		void run(uint32_t count, const Job& job);
+		
+	private:
+		NM500Pool(const NM500Pool&);
+		NM500Pool& operator=(const NM500Pool&);
+		
+		// tasks first..last-1 left to a worker, padded against false sharing
+		struct Slice {
+			std::mutex lock;
+			uint32_t first;
+			uint32_t last;
+			uint8_t padding[64];
+		};
+		
+		std::vector<std::thread> threads;
+		Slice* slices;
+		unsigned workers;
+		
+		std::mutex lock;
+		std::condition_variable start;
+		std::condition_variable done;
+		const Job* job = nullptr;
+		uint32_t generation = 0;
+		unsigned active = 0;			// workers still running the job
+		bool stop = false;
+		
+		void loop(unsigned worker);
+		void work(unsigned worker);
+		bool next(unsigned worker, uint32_t* task);
+};
+
+// ------------------------------------------------------------
+// NM500Engine
+// Host implementation of the NeuroMem learn/classify semantics of
+// NeuroShield (see NM500Emulator) for large models and recorded data
+// sets, with up to NM500_ENGINE_MAX_NEURONS neurons.
+// - the neurons are stored in shards of NM500_ENGINE_SHARD neurons,
+//   filled one after the other in the order of their identifiers
+// - learn() and classify() of a single vector spread the shards over
+//   the workers and merge their responses
+// - classifyBatch() spreads chunks of NM500_ENGINE_CHUNK vectors over
+//   the workers, which scan the shards one after the other for all the
+//   vectors of a chunk so that a shard stays in cache
+// The responses come by increasing distance, then category, then
+// identifier, as the readout of the chip. Build with -pthread.
+// ------------------------------------------------------------
+class NM500Engine
+{
+	public:
+		typedef NeuroShield::Result Result;
+		
+		NM500Engine(uint16_t neurons = NM500_ENGINE_MAX_NEURONS, unsigned threads = 0);
+		~NM500Engine();
+		
+		unsigned threadCount();
+		uint16_t getNcount();
+		void forget();
+		void forget(uint16_t maxif);
+		void setGcr(uint16_t value);
+		uint16_t getGcr();
+		void setContext(uint8_t context);
+		void setContext(uint8_t context, uint16_t minif, uint16_t maxif);
+		void getContext(uint8_t* context, uint16_t* minif, uint16_t* maxif);
+		void setRbfClassifier();
+		void setKnnClassifier();
+		
+		uint16_t learn(const uint8_t* vector, uint16_t length, uint16_t category);
+		uint16_t learnBatch(const uint8_t* vectors, uint32_t count, uint16_t length, const uint16_t categories[]);
+		uint16_t classify(const uint8_t* vector, uint16_t length);
+		uint16_t classify(const uint8_t* vector, uint16_t length, uint16_t k, Result results[]);
+		uint32_t classifyBatch(const uint8_t* vectors, uint32_t count, uint16_t length, Result* out);
+		uint32_t classifyBatch(const uint8_t* vectors, uint32_t count, uint16_t length, uint16_t k, Result* out);
+		
+		void readNeuron(uint16_t nid, uint16_t neuron[], uint16_t length);
+		void writeNeurons(const uint16_t* neurons, uint16_t ncount, uint16_t length);
+		
+		uint16_t total_neurons;
+		
+	private:
+		NM500Engine(const NM500Engine&);
+		NM500Engine& operator=(const NM500Engine&);
+		
+		// neurons first..first+ncount-1 (chain positions), one array per field
+		struct Shard {
+			uint8_t* comp;				// NM500_ENGINE_SHARD * NEURON_SIZE, aligned prototypes
+			uint8_t* comp_alloc;
+			uint16_t ncr[NM500_ENGINE_SHARD];
+			uint16_t aif[NM500_ENGINE_SHARD];
+			uint16_t minif[NM500_ENGINE_SHARD];
+			uint16_t cat[NM500_ENGINE_SHARD];
+			uint16_t first;
+			uint16_t ncount;
+		};
+		
+		// firing neurons of a vector: up to k responses by increasing
+		// distance, category and identifier, and the categories met
+		struct Response {
+			Result* top;
+			uint16_t k;
+			uint16_t count;
+			uint16_t first_cat;			// 0xFFFF if no neuron fires
+			bool uncertain;				// two categories fire
+		};
+		
+		// outcome of learning a vector in a shard
+		struct LearnResponse {
+			bool recognized;			// a firing neuron has the category
+			uint16_t closest;			// distance of the closest neuron of another category
+		};
+		
+		std::vector<Shard*> shards;
+		NM500Pool pool;
+		std::vector<uint16_t> dist;		// NM500_ENGINE_SHARD distances per worker
+		uint16_t ncount = 0;
+		
+		uint16_t gcr = 0x0001;
+		uint16_t nsr = 0;				// KNN mode bit
+		uint16_t global_minif = 2;
+		uint16_t global_maxif = 0x4000;
+		
+		bool inContext(uint16_t ncr);
+		uint16_t* workerDist(unsigned worker);
+		uint32_t activeShards();
+		void scan(const Shard& shard, const uint8_t* vector, uint16_t length, uint16_t* dist, Response& response);
+		void insert(Response& response, uint16_t dist, uint16_t cat, uint16_t nid);
+		void merge(Response& response, const Response& part);
+		uint16_t finish(Response& response);
+		void recognize(const uint8_t* vector, uint16_t length, Response& response);
+		void learnShard(Shard& shard, const uint8_t* vector, uint16_t length, uint16_t category, uint16_t* dist, LearnResponse& response);
+		void commit(const uint8_t* vector, uint16_t length, uint16_t ncr, uint16_t aif, uint16_t minif, uint16_t cat);
+};
+
+#endif // !ARDUINO
+
+#endif // _NM500ENGINE_H
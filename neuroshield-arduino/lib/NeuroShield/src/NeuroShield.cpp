@@ -44,21 +44,41 @@
 #include <NeuroShield.h>
 #include <NeuroShieldSPI.h>
 
+#if NEUROSHIELD_SDCARD
 #include <SdFat.h>
+#include <NeuroShieldKnowledge.h>
+#endif
 
 extern "C"
 {
 #include <stdint.h>
+#include <string.h>
 }
 
+#if defined(__AVR__)
+#include <avr/eeprom.h>
+#endif
+
+#if NEUROSHIELD_SDCARD
 SdFat SD;
+#endif
 
-NeuroShieldSPI spi;
+// steps of classifyAsync(), one frame each
+#define ASYNC_IDLE		0
+#define ASYNC_COMP		1
+#define ASYNC_LCOMP		2
+#define ASYNC_DIST		3
+#define ASYNC_CAT		4
+#define ASYNC_NID		5
+#define ASYNC_NSR		6
 
 // ------------------------------------------------------------ //
 //    Constructor to the class NeuroShield
 // ------------------------------------------------------------
 NeuroShield::NeuroShield() {
+#if NEUROSHIELD_STATS
+	resetStats();
+#endif
 }
 
 // ------------------------------------------------------------
@@ -66,39 +86,57 @@ NeuroShield::NeuroShield() {
 // 0:fail,  other: success(return total_neurons)
 // ------------------------------------------------------------
 uint16_t NeuroShield::begin() {
-	bool read_value = spi.connect(ARDUINO_SS); // default CS.
-
-	if (read_value != 1) {
+	if (start(ARDUINO_SS, 0) == 0) // default CS.
 		return (0);
-	} else {
-		countTotalNeurons();
-		clearNeurons();
-
-		uint16_t fpga_version = spi.version();
-		if ((fpga_version != 0x0001) && (fpga_version != 0x0002))
-			support_burst_read = 1;
-
-		if (SD.begin(ARDUINO_SD_CS)) {
-			SD_detected = true;
-		}
 
-		return (total_neurons);
+#if NEUROSHIELD_SDCARD
+	if (SD.begin(ARDUINO_SD_CS)) {
+		SD_detected = true;
 	}
+#endif
+
+	return (total_neurons);
 }
 
 uint16_t NeuroShield::begin(uint8_t slaveSelect) {
-	bool read_value = spi.connect(slaveSelect);
+	return (start(slaveSelect, 0));
+}
+
+// ------------------------------------------------------------
+// Initialize the neural network with begin flags
+// NM_BEGIN_FAST: poll the NM500 after its reset instead of waiting the
+//   worst-case delays, take the number of neurons from the cache of
+//   the last count made with the same FPGA version, and leave the
+//   clear of the neuron memory to the first learn
+// NM_BEGIN_AUTO_CLOCK: raise the spi clock up to NM500_SPI_CLK_MAX
+//   as long as the NM500 registers read back what was written
+// ------------------------------------------------------------
+uint16_t NeuroShield::begin(uint8_t slaveSelect, uint8_t flags) {
+	return (start(slaveSelect, flags));
+}
+
+uint16_t NeuroShield::start(uint8_t slave_select, uint8_t flags) {
+	bool read_value = spi.connect(slave_select, ((flags & NM_BEGIN_FAST) != 0));
 
 	if (read_value != 1) {
 		return (0);
 	} else {
-		countTotalNeurons();
-		clearNeurons();
+		if (flags & NM_BEGIN_AUTO_CLOCK)
+			spi.probeClock(NM500_SPI_CLK_MAX);
 
 		uint16_t fpga_version = spi.version();
 		if ((fpga_version != 0x0001) && (fpga_version != 0x0002))
 			support_burst_read = 1;
 
+		if (flags & NM_BEGIN_FAST) {
+			total_neurons = readTotalNeurons(fpga_version);
+			forget();
+			clear_pending = true;
+		} else {
+			countTotalNeurons();
+			clearNeurons();
+		}
+
 		return (total_neurons);
 	}
 }
@@ -243,6 +281,7 @@ uint16_t NeuroShield::getGcr() {
 //---------------------------------------------------------
 void NeuroShield::resetChain() {
 	spi.write(NM_RSTCHAIN, 0);
+	chain_nid = 0;
 	POWERSAVE;
 }
 
@@ -255,6 +294,7 @@ void NeuroShield::resetChain() {
 //---------------------------------------------------------
 void NeuroShield::setNsr(uint16_t value) {
 	spi.write(NM_NSR, value);
+	chain_nid = 0;
 	POWERSAVE;
 }
 
@@ -278,7 +318,49 @@ uint16_t NeuroShield::getNcount() {
 //---------------------------------------------------------
 void NeuroShield::setPowerSave() {
 	spi.write(NM_POWERSAVE, 1);
-	POWERSAVE;
+	power_pending = false;
+}
+
+// --------------------------------------------------------
+// Select when the power-save command is sent
+// NM_POWERSAVE_EACH: at the end of every call, or when the
+//   outermost hold is released
+// NM_POWERSAVE_DEFERRED: only on idle() or setPowerSave()
+//---------------------------------------------------------
+void NeuroShield::setPowerPolicy(uint8_t policy) {
+	power_policy = policy;
+	if ((policy == NM_POWERSAVE_EACH) && (power_hold == 0))
+		idle();
+}
+
+// --------------------------------------------------------
+// Hold/Release the power-save command so that a sequence of calls
+// issues it once at the end. Holds can be nested.
+//---------------------------------------------------------
+void NeuroShield::holdPowerSave() {
+	power_hold++;
+}
+
+void NeuroShield::releasePowerSave() {
+	if (power_hold > 0)
+		power_hold--;
+	if ((power_hold == 0) && (power_policy == NM_POWERSAVE_EACH))
+		idle();
+}
+
+// --------------------------------------------------------
+// Send the pending power-save command, if any
+//---------------------------------------------------------
+void NeuroShield::idle() {
+	if (power_pending)
+		setPowerSave();
+}
+
+void NeuroShield::powerSave() {
+	if ((power_hold > 0) || (power_policy != NM_POWERSAVE_EACH))
+		power_pending = true;
+	else
+		setPowerSave();
 }
 
 // ------------------------------------------------------------
@@ -287,6 +369,9 @@ void NeuroShield::setPowerSave() {
 // ------------------------------------------------------------
 void NeuroShield::forget() {
 	spi.write(NM_FORGET, 0);
+	chain_nid = 0;
+	checkpoint_ncount = 0;
+	countNeurons(0);
 	POWERSAVE;
 }
 
@@ -296,15 +381,20 @@ void NeuroShield::forget() {
 // ------------------------------------------------------------
 void NeuroShield::forget(uint16_t maxif) {
 	spi.write(NM_FORGET, 0);
+	chain_nid = 0;
+	checkpoint_ncount = 0;
+	countNeurons(0);
 	spi.write(NM_MAXIF, maxif);
 	POWERSAVE;
 }
 
 // ------------------------------------------------------------
 // Count total neurons in SR-mode
+// The categories are read in bursts when the FPGA supports it
 // ------------------------------------------------------------
 void NeuroShield::countTotalNeurons() {
-	uint16_t read_cat;
+	uint16_t read_cat[32];
+	bool last = false;
 
 	spi.write(NM_FORGET, 0);
 	spi.write(NM_NSR, 0x0010);
@@ -312,17 +402,72 @@ void NeuroShield::countTotalNeurons() {
 	spi.write(NM_RSTCHAIN, 0);
 
 	total_neurons = 0;
-	while (1) {
-		read_cat = spi.read(NM_CAT);
-		if (read_cat == 0xFFFF)
-			break;
-		total_neurons++;
+	while (!last) {
+		uint16_t size = 1;
+		if (support_burst_read == 1) {
+			size = 32;
+			spi.readBurst(NM_CAT, read_cat, size);
+		} else {
+			read_cat[0] = spi.read(NM_CAT);
+		}
+		for (uint16_t i = 0; (i < size) && !last; i++) {
+			if (read_cat[i] == 0xFFFF)
+				last = true;
+			else
+				total_neurons++;
+		}
 	}
 	spi.write(NM_NSR, 0x0000);
 	spi.write(NM_FORGET, 0);
+	checkpoint_ncount = 0;
+	countNeurons(0);
 	POWERSAVE;
 }
 
+// ------------------------------------------------------------
+// Number of neurons from the cache when it holds a count made with
+// the same FPGA version, otherwise count them and update the cache.
+// The cache is kept in EEPROM on AVR so that it survives a power cycle.
+// Other targets have no persistent storage here: the cache is a RAM
+// static, which only spares the count of a second begin() in a run.
+// ------------------------------------------------------------
+#define NM_COUNT_CACHE_MAGIC	0x4E43
+
+#if defined(__AVR__)
+static void readCountCache(uint16_t record[3]) {
+	eeprom_read_block(record, (const void *)(NEUROSHIELD_EEPROM_ADDR), (3 * sizeof(uint16_t)));
+}
+
+static void writeCountCache(uint16_t record[3]) {
+	eeprom_update_block(record, (void *)(NEUROSHIELD_EEPROM_ADDR), (3 * sizeof(uint16_t)));
+}
+#else
+static uint16_t count_cache[3];
+
+static void readCountCache(uint16_t record[3]) {
+	memcpy(record, count_cache, sizeof(count_cache));
+}
+
+static void writeCountCache(uint16_t record[3]) {
+	memcpy(count_cache, record, sizeof(count_cache));
+}
+#endif
+
+uint16_t NeuroShield::readTotalNeurons(uint16_t fpga_version) {
+	uint16_t record[3];		// magic number, FPGA version, neuron count
+
+	readCountCache(record);
+	if ((record[0] == NM_COUNT_CACHE_MAGIC) && (record[1] == fpga_version) && (record[2] != 0))
+		return (record[2]);
+
+	countTotalNeurons();
+	record[0] = NM_COUNT_CACHE_MAGIC;
+	record[1] = fpga_version;
+	record[2] = total_neurons;
+	writeCountCache(record);
+	return (total_neurons);
+}
+
 // --------------------------------------------------------------
 // Un-commit all the neurons, so they become ready to learn,
 // Set the Maximum Influence Field (default value=0x4000)
@@ -338,9 +483,25 @@ void NeuroShield::clearNeurons() {
 		spi.write(NM_TESTCOMP, 0);
 	}
 	spi.write(NM_FORGET, 0);
+	spi.markCompsClear();
+	clear_pending = false;
+	checkpoint_ncount = 0;
+	countNeurons(0);
 	POWERSAVE;
 }
 
+// --------------------------------------------------------------
+// Clear the neuron memory left as is by a fast boot, if no neuron
+// was committed since. Called before the first learn.
+// --------------------------------------------------------------
+void NeuroShield::clearIfPending() {
+	if (!clear_pending)
+		return;
+	clear_pending = false;
+	if (spi.read(NM_NCOUNT) == 0)
+		clearNeurons();
+}
+
 // --------------------------------------------------------
 // Broadcast a vector to the neurons and return the recognition status
 // 0=unknown, 4=uncertain, 8=Identified
@@ -356,12 +517,67 @@ uint16_t NeuroShield::broadcast(uint8_t vector[], uint16_t length) {
 
 //-----------------------------------------------
 // Learn a vector using the current context value
+// An empty vector is not learned
 //----------------------------------------------
 uint16_t NeuroShield::learn(uint8_t vector[], uint16_t length, uint16_t category) {
+	if (length == 0)
+		return (getNcount());
+	NeuroShieldPowerGuard guard(*this);
 	uint16_t ret_val;
+	clearIfPending();
 	broadcast(vector, length);
 	spi.write(NM_CAT, category);
 	ret_val = spi.read(NM_NCOUNT);
+	countLearn(1, ret_val);
+	POWERSAVE;
+	return (ret_val);
+}
+
+//-----------------------------------------------
+// Learn count vectors stored one after the other (count * length
+// bytes), the vector i with categories[i], using the current context
+// The vectors are sent back-to-back under a single power-save and
+// NCOUNT is read once at the end. When stats is given, NCOUNT is also
+// read at the start, and the NSR (plus the top category if identified)
+// is read per vector to count the vectors which shrank neurons.
+// Nothing is learned when count or length is 0.
+// Return the number of committed neurons
+//----------------------------------------------
+uint16_t NeuroShield::learnBatch(const uint8_t *vectors, uint16_t count, uint16_t length, const uint16_t categories[], LearnStats *stats) {
+	if ((count == 0) || (length == 0)) {
+		if (stats != nullptr) {
+			stats->committed = 0;
+			stats->shrunk = 0;
+		}
+		return (getNcount());
+	}
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t ret_val;
+	uint16_t first_ncount = 0;
+
+	clearIfPending();
+	if (stats != nullptr) {
+		stats->shrunk = 0;
+		first_ncount = spi.read(NM_NCOUNT);
+	}
+	for (uint16_t i = 0; i < count; i++) {
+		spi.writeVector(vectors, (length - 1));
+		spi.write(NM_LCOMP, vectors[length - 1]);
+		if (stats != nullptr) {
+			// a firing neuron of another category is about to shrink
+			uint16_t nsr = spi.read(NM_NSR);
+			if (nsr & 0x0004)
+				stats->shrunk++;
+			else if ((nsr & 0x0008) && ((spi.read(NM_CAT) & 0x7FFF) != categories[i]))
+				stats->shrunk++;
+		}
+		spi.write(NM_CAT, categories[i]);
+		vectors += length;
+	}
+	ret_val = spi.read(NM_NCOUNT);
+	if (stats != nullptr)
+		stats->committed = ret_val - first_ncount;
+	countLearn(count, ret_val);
 	POWERSAVE;
 	return (ret_val);
 }
@@ -373,9 +589,11 @@ uint16_t NeuroShield::learn(uint8_t vector[], uint16_t length, uint16_t category
 // NSR=4, uncertain
 // ---------------------------------------------------------
 uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length) {
+	NeuroShieldPowerGuard guard(*this);
 	uint16_t ret_val;
 	broadcast(vector, length);
 	ret_val = spi.read(NM_NSR);
+	countClassify(ret_val);
 	POWERSAVE;
 	return (ret_val);
 }
@@ -385,12 +603,14 @@ uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length) {
 // category, distance and identifier of the top firing neuron
 //----------------------------------------------
 uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length, uint16_t *distance, uint16_t *category, uint16_t *nid) {
+	NeuroShieldPowerGuard guard(*this);
 	uint16_t ret_val;
 	broadcast(vector, length);
 	*distance = spi.read(NM_DIST);
 	*category = spi.read(NM_CAT);
 	*nid = spi.read(NM_NID);
 	ret_val = spi.read(NM_NSR);
+	countClassify(ret_val);
 	POWERSAVE;
 	return (ret_val);
 }
@@ -402,24 +622,215 @@ uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length, uint16_t *dist
 // Return the number of firing neurons or K whichever is smaller
 //----------------------------------------------
 uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[]) {
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t nsr = broadcast(vector, length);
+	countClassify(nsr);
 	uint16_t recog_nbr = 0;
+	bool more = readoutStarts(nsr);
+	for (int i = 0; i < k; i++) {
+		if (readResponse(more, &distance[i], &category[i], &nid[i]))
+			recog_nbr++;
+	}
+	POWERSAVE;
+	return (recog_nbr);
+}
 
-	broadcast(vector, length);
+//----------------------------------------------
+// Same as above with the responses in results, all with the
+// classification status
+//----------------------------------------------
+uint16_t NeuroShield::classify(uint8_t vector[], uint16_t length, uint16_t k, Result results[]) {
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t nsr = broadcast(vector, length);
+	countClassify(nsr);
+	uint16_t recog_nbr = 0;
+	bool more = readoutStarts(nsr);
 	for (int i = 0; i < k; i++) {
-		distance[i] = spi.read(NM_DIST);
-		if (distance[i] == 0xFFFF) {
-			category[i] = 0xFFFF;
-			nid[i] = 0xFFFF;
+		results[i].status = nsr;
+		if (readResponse(more, &results[i].dist, &results[i].cat, &results[i].nid))
+			recog_nbr++;
+	}
+	POWERSAVE;
+	return (recog_nbr);
+}
+
+//----------------------------------------------
+// Recognize a vector and return the distance of up to K top firing
+// neurons, 0xFFFF past the last one
+// Return the number of firing neurons or K whichever is smaller
+//----------------------------------------------
+uint16_t NeuroShield::classifyDistances(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[]) {
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t nsr = broadcast(vector, length);
+	countClassify(nsr);
+	uint16_t recog_nbr = 0;
+	bool more = readoutStarts(nsr);
+	for (int i = 0; i < k; i++) {
+		if (readResponse(more, &distance[i], NULL, NULL))
+			recog_nbr++;
+	}
+	POWERSAVE;
+	return (recog_nbr);
+}
+
+//----------------------------------------------
+// Whether the broadcast which returned nsr has responses to read out
+// In RBF mode nothing fires when the vector is neither identified nor
+// uncertain. In KNN mode the readout runs until DIST reads 0xFFFF.
+//----------------------------------------------
+bool NeuroShield::readoutStarts(uint16_t nsr) {
+	return ((nsr & 0x0020) || (nsr & 0x000C));
+}
+
+//----------------------------------------------
+// Read the next response of the readout into distance, category and
+// nid, 0xFFFF once the readout is over. The category and identifier
+// are not read when category is NULL.
+// more is cleared when DIST reads 0xFFFF
+// Return true for a firing neuron
+//----------------------------------------------
+bool NeuroShield::readResponse(bool &more, uint16_t *distance, uint16_t *category, uint16_t *nid) {
+	if (more) {
+		*distance = spi.read(NM_DIST);
+		more = (*distance != 0xFFFF);
+	}
+	if (!more) {
+		*distance = 0xFFFF;
+		if (category != NULL) {
+			*category = 0xFFFF;
+			*nid = 0xFFFF;
+		}
+		return (false);
+	}
+	if (category != NULL) {
+		*category = spi.read(NM_CAT);
+		*nid = spi.read(NM_NID);
+	}
+	return (true);
+}
+
+//----------------------------------------------
+// Recognize count vectors stored one after the other (count * length
+// bytes) and fill one result per vector with the status, distance,
+// category and identifier of the top firing neuron.
+// The vectors are sent back-to-back under a single power-save, the mode
+// bits of the NSR are read once, and only DIST is read when no neuron
+// fires.
+// Return the number of vectors recognized by at least one neuron
+//----------------------------------------------
+uint16_t NeuroShield::classifyBatch(const uint8_t *vectors, uint16_t count, uint16_t length, Result *out) {
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t recog_nbr = 0;
+	uint16_t mode = spi.readShadow(NM_NSR) & 0x0030;
+
+	for (uint16_t i = 0; i < count; i++) {
+		spi.writeVector(vectors, (length - 1));
+		spi.write(NM_LCOMP, vectors[length - 1]);
+		out->dist = spi.read(NM_DIST);
+		if (out->dist == 0xFFFF) {
+			out->status = mode;
+			out->cat = 0xFFFF;
+			out->nid = 0xFFFF;
 		} else {
 			recog_nbr++;
-			category[i] = spi.read(NM_CAT);
-			nid[i] = spi.read(NM_NID);
+			out->cat = spi.read(NM_CAT);
+			out->nid = spi.read(NM_NID);
+			out->status = spi.read(NM_NSR);
 		}
+		countClassify(out->status);
+		vectors += length;
+		out++;
 	}
 	POWERSAVE;
 	return (recog_nbr);
 }
 
+// ------------------------------------------------------------
+// Start the recognition of a vector without waiting for the result
+// Each poll() sends one frame of at most NM_ASYNC_CHUNK components or
+// reads one register, so that the caller can sample its sensors or
+// use other SPI devices between two polls. callback receives the
+// response of the top firing neuron, as in classifyBatch(), from the
+// poll() which reads it back and may start the next recognition.
+// The vector must stay unchanged and the other calls must not be used
+// on this shield until then.
+// Return false if a recognition is already pending
+// ------------------------------------------------------------
+bool NeuroShield::classifyAsync(const uint8_t *vector, uint16_t length, ClassifyCallback callback, void *ctx) {
+	if ((async_state != ASYNC_IDLE) || (length == 0) || (length > NEURON_SIZE))
+		return (false);
+	holdPowerSave();
+	async_vector = vector;
+	async_length = length;
+	async_pos = 0;
+	async_callback = callback;
+	async_ctx = ctx;
+	async_state = (length > 1) ? ASYNC_COMP : ASYNC_LCOMP;
+	return (true);
+}
+
+// ------------------------------------------------------------
+// Advance the pending recognition by one frame
+// Return true while it is still pending
+// ------------------------------------------------------------
+bool NeuroShield::poll() {
+	switch (async_state) {
+		case ASYNC_COMP: {
+			uint16_t n = async_length - 1 - async_pos;
+			if (n > NM_ASYNC_CHUNK)
+				n = NM_ASYNC_CHUNK;
+			spi.writeVector(&async_vector[async_pos], n);
+			async_pos += n;
+			if (async_pos == (async_length - 1))
+				async_state = ASYNC_LCOMP;
+			break;
+		}
+		case ASYNC_LCOMP:
+			spi.write(NM_LCOMP, async_vector[async_length - 1]);
+			async_state = ASYNC_DIST;
+			break;
+		case ASYNC_DIST:
+			async_result.dist = spi.read(NM_DIST);
+			if (async_result.dist == 0xFFFF) {
+				async_result.status = spi.readShadow(NM_NSR) & 0x0030;
+				async_result.cat = 0xFFFF;
+				async_result.nid = 0xFFFF;
+				completeAsync();
+			} else {
+				async_state = ASYNC_CAT;
+			}
+			break;
+		case ASYNC_CAT:
+			async_result.cat = spi.read(NM_CAT);
+			async_state = ASYNC_NID;
+			break;
+		case ASYNC_NID:
+			async_result.nid = spi.read(NM_NID);
+			async_state = ASYNC_NSR;
+			break;
+		case ASYNC_NSR:
+			async_result.status = spi.read(NM_NSR);
+			completeAsync();
+			break;
+		default:
+			break;
+	}
+	return (async_state != ASYNC_IDLE);
+}
+
+bool NeuroShield::busy() {
+	return (async_state != ASYNC_IDLE);
+}
+
+void NeuroShield::completeAsync() {
+	async_state = ASYNC_IDLE;
+	countClassify(async_result.status);
+	POWERSAVE;
+	if (async_callback != NULL)
+		async_callback(async_ctx, async_result);
+	releasePowerSave();
+}
+
 // ------------------------------------------------------------
 // Set a context and associated minimum and maximum influence fields
 // ------------------------------------------------------------
@@ -427,9 +838,9 @@ void NeuroShield::setContext(uint8_t context) {
 	// context[15-8]= unused
 	// context[7]= Norm (0 for L1; 1 for LSup)
 	// context[6-0]= Active context value
-	uint16_t read_val = spi.read(NM_GCR);
+	uint16_t read_val = spi.readShadow(NM_GCR);
 	read_val = (read_val & 0xFF80) | (context & 0x007F);
-	spi.write(NM_GCR, read_val);
+	spi.update(NM_GCR, read_val);
 	POWERSAVE;
 }
 
@@ -440,11 +851,11 @@ void NeuroShield::setContext(uint8_t context, uint16_t minif, uint16_t maxif) {
 	// context[15-8]= unused
 	// context[7]= Norm (0 for L1; 1 for LSup)
 	// context[6-0]= Active context value
-	uint16_t read_val = spi.read(NM_GCR);
+	uint16_t read_val = spi.readShadow(NM_GCR);
 	read_val = (read_val & 0xFF80) | (context & 0x007F);
-	spi.write(NM_GCR, read_val);
-	spi.write(NM_MINIF, minif);
-	spi.write(NM_MAXIF, maxif);
+	spi.update(NM_GCR, read_val);
+	spi.update(NM_MINIF, minif);
+	spi.update(NM_MAXIF, maxif);
 	POWERSAVE;
 }
 
@@ -455,9 +866,18 @@ void NeuroShield::getContext(uint8_t *context, uint16_t *minif, uint16_t *maxif)
 	// context[15-8]= unused
 	// context[7]= Norm (0 for L1; 1 for LSup)
 	// context[6-0]= Active context value
-	*context = (uint8_t)(spi.read(NM_GCR) & 0x007F);
-	*minif = spi.read(NM_MINIF);
-	*maxif = spi.read(NM_MAXIF);
+	*context = (uint8_t)(spi.readShadow(NM_GCR) & 0x007F);
+	*minif = spi.readShadow(NM_MINIF);
+	*maxif = spi.readShadow(NM_MAXIF);
+	POWERSAVE;
+}
+
+// ------------------------------------------------------------
+// Read again the registers shadowed by the driver (GCR, NSR, MINIF,
+// MAXIF), to call after the NM500 was changed behind the library
+// ------------------------------------------------------------
+void NeuroShield::resync() {
+	spi.resyncShadow();
 	POWERSAVE;
 }
 
@@ -465,7 +885,7 @@ void NeuroShield::getContext(uint8_t *context, uint16_t *minif, uint16_t *maxif)
 // Set the neurons in Radial Basis Function mode (default)
 //---------------------------------------------------------
 void NeuroShield::setRbfClassifier() {
-	uint16_t temp_nsr = spi.read(NM_NSR);
+	uint16_t temp_nsr = spi.readShadow(NM_NSR);
 	spi.write(NM_NSR, (temp_nsr & 0x00DF));
 	POWERSAVE;
 }
@@ -474,11 +894,93 @@ void NeuroShield::setRbfClassifier() {
 // Set the neurons in K-Nearest Neighbor mode
 //---------------------------------------------------------
 void NeuroShield::setKnnClassifier() {
-	uint16_t temp_nsr = spi.read(NM_NSR);
+	uint16_t temp_nsr = spi.readShadow(NM_NSR);
 	spi.write(NM_NSR, (temp_nsr | 0x0020));
 	POWERSAVE;
 }
 
+//-------------------------------------------------------------
+// Open/Close a neuron read session
+// The network is kept in SR-mode between the two calls and the
+// position in the chain is remembered, so readNeuron() and
+// readNeurons() only move forward from the last neuron read.
+// Reading neurons by increasing index costs a single pass of the chain.
+//-------------------------------------------------------------
+void NeuroShield::beginNeuronRead() {
+	if (cursor_open == 0) {
+		holdPowerSave();
+		cursor_nsr = spi.readShadow(NM_NSR); // save value to restore NN status upon exit
+		spi.write(NM_NSR, 0x0010);
+		spi.write(NM_RSTCHAIN, 0);
+		chain_nid = 1;
+	}
+	cursor_open++;
+}
+
+void NeuroShield::endNeuronRead() {
+	if (cursor_open == 0)
+		return;
+	if (--cursor_open == 0) {
+		spi.write(NM_NSR, cursor_nsr); // set the NN back to its calling status
+		chain_nid = 0;
+		POWERSAVE;
+		releasePowerSave();
+	}
+}
+
+//-------------------------------------------------------------
+// Move the chain to the neuron nid, from the current position if it
+// is at or before nid, otherwise from the first neuron
+//-------------------------------------------------------------
+void NeuroShield::seekNeuron(uint16_t nid) {
+	if ((chain_nid == 0) || (nid < chain_nid)) {
+		spi.write(NM_NSR, 0x0010);
+		spi.write(NM_RSTCHAIN, 0);
+		chain_nid = 1;
+	}
+	// move to index in the chain of neurons
+	while (chain_nid < nid) {
+		spi.read(NM_CAT);
+		chain_nid++;
+	}
+}
+
+//-------------------------------------------------------------
+// Read the neuron pointed by the chain and move to the next one
+// NCR, length * COMP, AIF, MINIF, CAT
+//-------------------------------------------------------------
+void NeuroShield::readNeuronData(uint16_t neuron[], uint16_t length) {
+	neuron[0] = spi.read(NM_NCR);
+	if (support_burst_read == 1) {
+		spi.readVector16(&neuron[1], length);
+	} else {
+		for (int i = 0; i < length; i++)
+			neuron[i + 1] = spi.read(NM_COMP);
+	}
+	neuron[length + 1] = spi.read(NM_AIF);
+	neuron[length + 2] = spi.read(NM_MINIF);
+	neuron[length + 3] = spi.read(NM_CAT);
+	chain_nid++;
+}
+
+//-------------------------------------------------------------
+// Same as above with the registers in neuron and the length
+// components in comps, one byte each
+//-------------------------------------------------------------
+void NeuroShield::readNeuronData(Neuron *neuron, uint8_t comps[], uint16_t length) {
+	neuron->ncr = spi.read(NM_NCR);
+	if (support_burst_read == 1) {
+		spi.readVector(comps, length);
+	} else {
+		for (int i = 0; i < length; i++)
+			comps[i] = (uint8_t)spi.read(NM_COMP);
+	}
+	neuron->aif = spi.read(NM_AIF);
+	neuron->minif = spi.read(NM_MINIF);
+	neuron->cat = spi.read(NM_CAT);
+	chain_nid++;
+}
+
 //-------------------------------------------------------------
 // Read the contents of the neuron pointed by index in the chain of neurons
 // starting at index 1
@@ -491,15 +993,8 @@ void NeuroShield::readNeuron(uint16_t nid, uint16_t model[], uint16_t *ncr, uint
 		return;
 	}
 
-	uint16_t temp_nsr = spi.read(NM_NSR);
-	spi.write(NM_NSR, 0x0010);
-	spi.write(NM_RSTCHAIN, 0);
-	if (nid > 1) {
-		// move to index in the chain of neurons
-		for (int i = 1; i < nid; i++)
-			spi.read(NM_CAT);
-	}
-
+	beginNeuronRead();
+	seekNeuron(nid);
 	*ncr = spi.read(NM_NCR);
 	if (support_burst_read == 1) {
 		spi.readVector16(model, NEURON_SIZE);
@@ -509,8 +1004,8 @@ void NeuroShield::readNeuron(uint16_t nid, uint16_t model[], uint16_t *ncr, uint
 	}
 	*aif = spi.read(NM_AIF);
 	*cat = spi.read(NM_CAT);
-	spi.write(NM_NSR, temp_nsr); // set the NN back to its calling status
-	POWERSAVE;
+	chain_nid++;
+	endNeuronRead();
 }
 
 //-------------------------------------------------------------
@@ -520,34 +1015,45 @@ void NeuroShield::readNeuron(uint16_t nid, uint16_t model[], uint16_t *ncr, uint
 // NCR, NEURON_SIZE * COMP, AIF, MINIF, CAT
 //-------------------------------------------------------------
 void NeuroShield::readNeuron(uint16_t nid, uint16_t neuron[]) {
+	readNeuron(nid, neuron, NEURON_SIZE);
+}
+
+//-------------------------------------------------------------
+// Same as above with only the first length components of the neuron,
+// in an array of (length + 4) words: NCR, length * COMP, AIF, MINIF, CAT
+//-------------------------------------------------------------
+void NeuroShield::readNeuron(uint16_t nid, uint16_t neuron[], uint16_t length) {
 	if (nid == 0) {
-		for (int i = 0; i < (NEURON_SIZE + 4); i++) {
+		for (int i = 0; i < (length + 4); i++) {
 			neuron[i] = 0xFFFF;
 		}
 		return;
 	}
 
-	uint16_t temp_nsr = spi.read(NM_NSR);
-	spi.write(NM_NSR, 0x0010);
-	spi.write(NM_RSTCHAIN, 0);
-	if (nid > 1) {
-		// move to index in the chain of neurons
-		for (int i = 1; i < nid; i++)
-			spi.read(NM_CAT);
-	}
+	beginNeuronRead();
+	seekNeuron(nid);
+	readNeuronData(neuron, length);
+	endNeuronRead();
+}
 
-	neuron[0] = spi.read(NM_NCR);
-	if (support_burst_read == 1) {
-		spi.readVector16(&neuron[1], NEURON_SIZE);
-	} else {
-		for (int i = 0; i < NEURON_SIZE; i++)
-			neuron[i + 1] = spi.read(NM_COMP);
+//-------------------------------------------------------------
+// Same as above with the registers of the neuron in neuron and its
+// first length components in comps, one byte each (length bytes)
+//-------------------------------------------------------------
+void NeuroShield::readNeuron(uint16_t nid, Neuron *neuron, uint8_t comps[], uint16_t length) {
+	if (nid == 0) {
+		neuron->ncr = 0xFFFF;
+		neuron->aif = 0xFFFF;
+		neuron->minif = 0xFFFF;
+		neuron->cat = 0xFFFF;
+		memset(comps, 0xFF, length);
+		return;
 	}
-	neuron[NEURON_SIZE + 1] = spi.read(NM_AIF);
-	neuron[NEURON_SIZE + 2] = spi.read(NM_MINIF);
-	neuron[NEURON_SIZE + 3] = spi.read(NM_CAT);
-	spi.write(NM_NSR, temp_nsr); // set the NN back to its calling status
-	POWERSAVE;
+
+	beginNeuronRead();
+	seekNeuron(nid);
+	readNeuronData(neuron, comps, length);
+	endNeuronRead();
 }
 
 //----------------------------------------------------------------------------
@@ -557,28 +1063,101 @@ void NeuroShield::readNeuron(uint16_t nid, uint16_t neuron[]) {
 // and with the following format NCR, NEURON_SIZE * COMP, AIF, MINIF, CAT
 //----------------------------------------------------------------------------
 uint16_t NeuroShield::readNeurons(uint16_t neurons[]) {
+	return (readNeurons(1, 0xFFFF, neurons));
+}
+
+//----------------------------------------------------------------------------
+// Read the contents of count committed neurons starting at index first
+// The output array has a dimension count * neurondata (see above)
+// Return the number of neurons read, limited to the committed neurons
+//----------------------------------------------------------------------------
+uint16_t NeuroShield::readNeurons(uint16_t first, uint16_t count, uint16_t neurons[]) {
+	return (readNeurons(first, count, neurons, NEURON_SIZE));
+}
+
+//----------------------------------------------------------------------------
+// Same as above with only the first length components of each neuron,
+// the output array has a dimension count * (length + 4)
+//----------------------------------------------------------------------------
+uint16_t NeuroShield::readNeurons(uint16_t first, uint16_t count, uint16_t neurons[], uint16_t length) {
 	uint32_t offset = 0;
-	uint16_t ncount = spi.read(NM_NCOUNT);
-	uint16_t temp_nsr = spi.read(NM_NSR); // save value to restore NN status upon exit
-	spi.write(NM_NSR, 0x0010);
-	spi.write(NM_RSTCHAIN, 0);
-	for (int i = 1; i <= ncount; i++) {
-		neurons[offset + 0] = spi.read(NM_NCR);
-		if (support_burst_read == 1) {
-			spi.readVector16(&neurons[offset + 1], NEURON_SIZE);
-		} else {
-			for (int j = 0; j < NEURON_SIZE; j++) {
-				neurons[offset + 1 + j] = spi.read(NM_COMP);
-			}
-		}
-		neurons[offset + 1 + NEURON_SIZE] = spi.read(NM_AIF);
-		neurons[offset + 2 + NEURON_SIZE] = spi.read(NM_MINIF);
-		neurons[offset + 3 + NEURON_SIZE] = spi.read(NM_CAT);
-		offset += (NEURON_SIZE + 4);
+	if (first == 0)
+		return (0);
+
+	uint16_t ncount = spi.read(NM_NCOUNT);	// before SR-mode
+	beginNeuronRead();
+	if (first > ncount)
+		count = 0;
+	else if (count > (ncount - first + 1))
+		count = ncount - first + 1;
+	if (count > 0)
+		seekNeuron(first);
+	for (int i = 0; i < count; i++) {
+		readNeuronData(&neurons[offset], length);
+		offset += (length + 4);
 	}
-	spi.write(NM_NSR, temp_nsr); // set the NN back to its calling status
-	POWERSAVE;
-	return (ncount);
+	endNeuronRead();
+	return (count);
+}
+
+//----------------------------------------------------------------------------
+// Same as above with the registers of the neuron i in neurons[i] and
+// its components in comps[i * length]..comps[i * length + length - 1],
+// count * (8 + length) bytes in all instead of count * (length + 4) words
+//----------------------------------------------------------------------------
+uint16_t NeuroShield::readNeurons(uint16_t first, uint16_t count, Neuron neurons[], uint8_t comps[], uint16_t length) {
+	if (first == 0)
+		return (0);
+
+	uint16_t ncount = spi.read(NM_NCOUNT);	// before SR-mode
+	beginNeuronRead();
+	if (first > ncount)
+		count = 0;
+	else if (count > (ncount - first + 1))
+		count = ncount - first + 1;
+	if (count > 0)
+		seekNeuron(first);
+	for (int i = 0; i < count; i++) {
+		readNeuronData(&neurons[i], comps, length);
+		comps += length;
+	}
+	endNeuronRead();
+	return (count);
+}
+
+//----------------------------------------------------------------------------
+// Pass the committed neurons one after the other to callback, with
+// their registers and their first length components (NEURON_SIZE by
+// default), in a single pass of the chain. The neuron is in a buffer
+// of the stack reused for each neuron, which the callback copies if
+// it needs it later. The NM500 stays in SR-mode until the last call,
+// so the callback must not access it.
+// Return the number of neurons passed, less than the committed
+// neurons if the callback stops the iteration
+//----------------------------------------------------------------------------
+uint16_t NeuroShield::forEachNeuron(NeuronCallback callback, void *ctx) {
+	return (forEachNeuron(callback, ctx, NEURON_SIZE));
+}
+
+uint16_t NeuroShield::forEachNeuron(NeuronCallback callback, void *ctx, uint16_t length) {
+	uint8_t comps[NEURON_SIZE];
+	Neuron neuron;
+	uint16_t count = 0;
+
+	if (length > NEURON_SIZE)
+		length = NEURON_SIZE;
+	uint16_t ncount = spi.read(NM_NCOUNT);	// before SR-mode
+	beginNeuronRead();
+	if (ncount > 0)
+		seekNeuron(1);
+	while (count < ncount) {
+		readNeuronData(&neuron, comps, length);
+		count++;
+		if (!callback(ctx, count, neuron, comps, length))
+			break;
+	}
+	endNeuronRead();
+	return (count);
 }
 
 void NeuroShield::readCompVector(uint16_t *data, uint16_t size) {
@@ -593,6 +1172,18 @@ void NeuroShield::readCompVector(uint16_t *data, uint16_t size) {
 	POWERSAVE;
 }
 
+void NeuroShield::readCompVector(uint8_t *data, uint16_t size) {
+	if (support_burst_read == 1) {
+		spi.readVector(data, size);
+	} else {
+		for (int i = 0; i < size; i++) {
+			*data = (uint8_t)spi.read(NM_COMP);
+			data++;
+		}
+	}
+	POWERSAVE;
+}
+
 //---------------------------------------------------------------------
 // Clear the neurons and write their content from an input array
 // The input array has a dimension ncount * neurondata
@@ -600,27 +1191,95 @@ void NeuroShield::readCompVector(uint16_t *data, uint16_t size) {
 // and with the following format NCR, NEURON_SIZE * COMP, AIF, MINIF, CAT
 //---------------------------------------------------------------------
 void NeuroShield::writeNeurons(uint16_t neurons[], uint16_t ncount) {
-	uint32_t offset = 0;
+	writeNeurons(neurons, ncount, NEURON_SIZE);
+}
+
+//---------------------------------------------------------------------
+// Same as above with neurondata of (length + 4) words holding the first
+// length components, the other components are cleared
+//---------------------------------------------------------------------
+void NeuroShield::writeNeurons(uint16_t neurons[], uint16_t ncount, uint16_t length) {
+	NeuroShieldPowerGuard guard(*this);
+	uint16_t temp_gcr = spi.readShadow(NM_GCR);
 	if (ncount > total_neurons)
 		ncount = total_neurons;
-	uint16_t temp_nsr = spi.read(NM_NSR); // save value to restore NN status upon exit
-	uint16_t temp_gcr = spi.read(NM_GCR);
-	clearNeurons();
-	spi.write(NM_NSR, 0x0010);
-	spi.write(NM_RSTCHAIN, 0);
+	beginRestore(length);
 	for (int i = 0; i < ncount; i++) {
-		spi.write(NM_NCR, neurons[offset + 0]);
-		spi.writeVector16(&neurons[offset + 1], NEURON_SIZE);
-		spi.write(NM_AIF, neurons[offset + 1 + NEURON_SIZE]);
-		spi.write(NM_MINIF, neurons[offset + 2 + NEURON_SIZE]);
-		spi.write(NM_CAT, neurons[offset + 3 + NEURON_SIZE]);
-		offset += (NEURON_SIZE + 4);
-	}
-	spi.write(NM_NSR, temp_nsr); // set the NN back to its calling status
+		restoreRecords(neurons, (length + 4));
+		neurons += (length + 4);
+	}
+	endRestore();
 	spi.write(NM_GCR, temp_gcr);
 	POWERSAVE;
 }
 
+//---------------------------------------------------------------------
+// Restore session
+// Forget the neurons and write new ones in SR-mode from records laid
+// out as in the knowledge files, NCR, length * COMP, AIF, MINIF, CAT.
+// The words are passed to restoreRecords() in chunks of any size, so
+// that a record may be split between two file buffers, and each one
+// is sent in as few frames as its fields allow.
+// With clear, the components past length are cleared first, unless
+// the full length is restored or no component was written since the
+// last clearNeurons().
+// endRestore() sets the NN back to its calling status and returns the
+// number of neurons written. The records past the capacity of the
+// chip are ignored.
+//---------------------------------------------------------------------
+void NeuroShield::beginRestore(uint16_t length, bool clear) {
+	holdPowerSave();
+	restore_nsr = spi.readShadow(NM_NSR); // save value to restore NN status upon exit
+	if (clear && (length < NEURON_SIZE) && !spi.compsClear())
+		clearNeurons();
+	else
+		forget();
+	clear_pending = false;
+	spi.write(NM_NSR, 0x0010);
+	spi.write(NM_RSTCHAIN, 0);
+	restore_length = length;
+	restore_field = 0;
+	restore_count = 0;
+}
+
+void NeuroShield::restoreRecords(const uint16_t *words, uint16_t count) {
+	uint16_t length = restore_length;
+	while ((count > 0) && (restore_count < total_neurons)) {
+		if (restore_field == 0) {
+			spi.write(NM_NCR, *words);
+		} else if (restore_field <= length) {
+			uint16_t n = length - restore_field + 1;
+			if (n > count)
+				n = count;
+			spi.writeVector16(words, n);
+			words += n;
+			count -= n;
+			restore_field += n;
+			continue;
+		} else if (restore_field == length + 1) {
+			spi.write(NM_AIF, *words);
+		} else if (restore_field == length + 2) {
+			spi.write(NM_MINIF, *words);
+		} else {
+			spi.write(NM_CAT, *words);
+			restore_count++;
+		}
+		words++;
+		count--;
+		if (++restore_field == (length + 4))
+			restore_field = 0;
+	}
+}
+
+uint16_t NeuroShield::endRestore() {
+	spi.write(NM_NSR, restore_nsr); // set the NN back to its calling status
+	chain_nid = 0;
+	countNeurons(restore_count);
+	POWERSAVE;
+	releasePowerSave();
+	return (restore_count);
+}
+
 // --------------------------------------------------------
 // Write N-component
 //---------------------------------------------------------
@@ -643,6 +1302,17 @@ uint16_t NeuroShield::testCommand(uint8_t read_write, uint8_t reg, uint16_t data
 	return (ret_val);
 }
 
+// ----------------------------------------------------------------
+// Get/Set the SPI clock of this shield in Hz (default 2MHz)
+// ----------------------------------------------------------------
+void NeuroShield::setSpiClock(uint32_t clock) {
+	spi.setClock(clock);
+}
+
+uint32_t NeuroShield::getSpiClock() {
+	return (spi.getClock());
+}
+
 // ----------------------------------------------------------------
 // Get FPGA Version
 // [15:8] board type : 00 = NeuroShield, 01 = Prodigy ...
@@ -667,13 +1337,50 @@ void NeuroShield::ledSelect(uint8_t data) {
 	spi.ledSelect(data);
 }
 
+#if NEUROSHIELD_STATS
 // --------------------------------------------------------
-// Save the knowledge of the neurons to a knowledge file
-// saved in a format compatible with the NeuroMem API
-// --------------------------------------------------------
-int NeuroShield::saveKnowledgeToSDcard(char *filename) {
-	uint16_t ncr, aif, minif, cat = 0;
+// Snapshot of the recognition and learning counters, and their reset
+// The bus counters are in spi.getStats()
+//---------------------------------------------------------
+void NeuroShield::getStats(Stats *out) {
+	memcpy(out, &stats, sizeof(Stats));
+}
+
+void NeuroShield::resetStats() {
+	memset(&stats, 0, sizeof(Stats));
+}
+
+void NeuroShield::countClassify(uint16_t status) {
+	stats.classified++;
+	if (status & 0x0008)
+		stats.identified++;
+	else if (status & 0x0004)
+		stats.uncertain++;
+	else
+		stats.unknown++;
+}
+
+// the neurons committed since the previous call were committed by learning
+void NeuroShield::countLearn(uint16_t count, uint16_t ncount) {
+	stats.learned += count;
+	if (ncount > stats_ncount)
+		stats.committed += (ncount - stats_ncount);
+	stats_ncount = ncount;
+}
+
+// the neurons were forgotten or restored
+void NeuroShield::countNeurons(uint16_t ncount) {
+	stats_ncount = ncount;
+}
+#endif
+
+#if NEUROSHIELD_SDCARD
 
+// --------------------------------------------------------
+// Create a knowledge file, replacing an existing one
+// 0: success, 1: SD card not found, 2: fail to open the file
+// --------------------------------------------------------
+static int knCreate(bool &SD_detected, char *filename, File &file) {
 	if (!SD_detected) {
 		SD_detected = SD.begin(ARDUINO_SD_CS);
 	}
@@ -687,47 +1394,577 @@ int NeuroShield::saveKnowledgeToSDcard(char *filename) {
 		SD.remove(filename);
 	}
 
-	File SDfile = SD.open(filename, (O_READ | O_WRITE | O_CREAT | O_TRUNC));
+	file = SD.open(filename, (O_READ | O_WRITE | O_CREAT | O_TRUNC));
 
 	// Fail to open file
-	if (!SDfile) {
+	if (!file) {
 		return (2);
 	}
+	return (0);
+}
+
+// --------------------------------------------------------
+// Append a word to the SD card buffer, write it when full
+// --------------------------------------------------------
+static void knPut(File &file, uint16_t buffer[], uint16_t &len, uint16_t data) {
+	buffer[len++] = data;
+	if (len == (KN_BUFFER_SIZE / 2)) {
+		file.write(buffer, KN_BUFFER_SIZE);
+		len = 0;
+	}
+}
+
+// --------------------------------------------------------
+// Save the knowledge of the neurons to a knowledge file
+// saved in a format compatible with the NeuroMem API
+// The file is written by KN_BUFFER_SIZE blocks, the components
+// are read in burst-mode straight into the buffer
+// --------------------------------------------------------
+int NeuroShield::saveKnowledgeToSDcard(char *filename) {
+	return (saveKnowledgeToSDcard(filename, NEURON_SIZE));
+}
+
+// --------------------------------------------------------
+// Same as above with only the first length components of the neurons,
+// the header of the file gives the length to the loader
+// --------------------------------------------------------
+int NeuroShield::saveKnowledgeToSDcard(char *filename, uint16_t length) {
+	NeuroShieldPowerGuard guard(*this);
+
+	// Neuron size error
+	if ((length == 0) || (length > NEURON_SIZE)) {
+		return (5);
+	}
+
+	File SDfile;
+	int ret_val = knCreate(SD_detected, filename, SDfile);
+	if (ret_val != 0) {
+		return (ret_val);
+	}
+
+	uint16_t buffer[KN_BUFFER_SIZE / 2];
+	uint16_t len = 0;
+
+	uint16_t ncount = spi.read(NM_NCOUNT);
+	knPut(SDfile, buffer, len, KN_FORMAT);
+	knPut(SDfile, buffer, len, length);
+	knPut(SDfile, buffer, len, ncount);
+	knPut(SDfile, buffer, len, 0);
+
+	beginNeuronRead();
+	for (int i = 1; i <= ncount; i++) {
+		knPut(SDfile, buffer, len, spi.read(NM_NCR));
+		uint16_t remain = length;
+		while (remain > 0) {
+			uint16_t words = (KN_BUFFER_SIZE / 2) - len;
+			if (words > remain)
+				words = remain;
+			readCompVector(&buffer[len], words);
+			len += words;
+			remain -= words;
+			if (len == (KN_BUFFER_SIZE / 2)) {
+				SDfile.write(buffer, KN_BUFFER_SIZE);
+				len = 0;
+			}
+		}
+		knPut(SDfile, buffer, len, spi.read(NM_AIF));
+		knPut(SDfile, buffer, len, spi.read(NM_MINIF));
+		knPut(SDfile, buffer, len, spi.read(NM_CAT));
+		chain_nid++;
+	}
+	endNeuronRead();
+
+	if (len > 0)
+		SDfile.write(buffer, (len * sizeof(uint16_t)));
+	SDfile.close();
+	return (0);
+}
+
+// --------------------------------------------------------
+// Byte access to a compact knowledge file through a block buffer,
+// with the CRC of the bytes written or read so far
+// --------------------------------------------------------
+struct KnStream {
+	File *file;
+	uint8_t buffer[KN_BUFFER_SIZE];
+	uint16_t len;
+	uint16_t pos;
+	uint16_t crc;
+	uint32_t offset;				// position in the file
+	bool eof;
+};
+
+static void knBeginWrite(KnStream *w, File *file, uint32_t offset) {
+	w->file = file;
+	w->len = 0;
+	w->crc = KN_CRC_INIT;
+	w->offset = offset;
+}
+
+static void knPutByte(void *ctx, uint8_t data) {
+	KnStream *w = (KnStream *)ctx;
+	w->crc = knCrc16(w->crc, &data, 1);
+	w->buffer[w->len++] = data;
+	w->offset++;
+	if (w->len == KN_BUFFER_SIZE) {
+		w->file->write(w->buffer, KN_BUFFER_SIZE);
+		w->len = 0;
+	}
+}
+
+static void knPutWord(KnStream *w, uint16_t data) {
+	knPutByte(w, (uint8_t)(data & 0x00FF));
+	knPutByte(w, (uint8_t)(data >> 8));
+}
+
+static void knFlush(KnStream *w) {
+	if (w->len > 0)
+		w->file->write(w->buffer, w->len);
+	w->len = 0;
+}
+
+// the first 8 bytes of the file were read in header
+static void knBeginRead(KnStream *r, File *file, uint16_t header[4]) {
+	r->file = file;
+	r->len = 0;
+	r->pos = 0;
+	r->crc = knCrc16(KN_CRC_INIT, (const uint8_t *)header, (4 * sizeof(uint16_t)));
+	r->offset = (4 * sizeof(uint16_t));
+	r->eof = false;
+}
+
+static uint8_t knGetByte(void *ctx) {
+	KnStream *r = (KnStream *)ctx;
+	if (r->pos == r->len) {
+		int read_len = r->file->read(r->buffer, KN_BUFFER_SIZE);
+		if (read_len <= 0) {
+			r->eof = true;
+			return (0);
+		}
+		r->len = read_len;
+		r->pos = 0;
+	}
+	uint8_t data = r->buffer[r->pos++];
+	r->crc = knCrc16(r->crc, &data, 1);
+	r->offset++;
+	return (data);
+}
+
+static uint16_t knGetWord(KnStream *r) {
+	uint16_t data = knGetByte(r);
+	return (data | ((uint16_t)knGetByte(r) << 8));
+}
+
+// --------------------------------------------------------
+// CRC of the AIF and CAT of the neurons, to detect the changes
+// between two checkpoints
+// --------------------------------------------------------
+static uint16_t knTableCrc(uint16_t crc, uint16_t aif, uint16_t cat) {
+	uint8_t data[4];
+	data[0] = (uint8_t)(aif & 0x00FF);
+	data[1] = (uint8_t)(aif >> 8);
+	data[2] = (uint8_t)(cat & 0x00FF);
+	data[3] = (uint8_t)(cat >> 8);
+	return (knCrc16(crc, data, 4));
+}
+
+// --------------------------------------------------------
+// Read the AIF and CAT of count neurons from the one pointed by the
+// chain in SR-mode, write them to w if not NULL and return their CRC
+// --------------------------------------------------------
+static uint16_t knPutTable(NeuroShield &nn, uint16_t count, KnStream *w) {
+	uint16_t crc = KN_CRC_INIT;
+	for (uint16_t i = 0; i < count; i++) {
+		uint16_t aif = nn.spi.read(NM_AIF);
+		uint16_t cat = nn.spi.read(NM_CAT);
+		if (w != NULL) {
+			knPutWord(w, aif);
+			knPutWord(w, cat);
+		}
+		crc = knTableCrc(crc, aif, cat);
+	}
+	return (crc);
+}
+
+// --------------------------------------------------------
+// Write the neuron pointed by the chain in SR-mode as a compact record
+// NCR, length components, AIF, MINIF, CAT
+// Returns the table CRC continued with its AIF and CAT
+// --------------------------------------------------------
+static uint16_t knPutNeuron(NeuroShield &nn, KnStream *w, uint16_t length, uint16_t flags, uint16_t crc) {
+	uint8_t comps[NEURON_SIZE];
+	knPutWord(w, nn.spi.read(NM_NCR));
+	nn.readCompVector(comps, length);
+	knEncodeComps(comps, length, flags, knPutByte, w);
+	uint16_t aif = nn.spi.read(NM_AIF);
+	uint16_t cat;
+	knPutWord(w, aif);
+	knPutWord(w, nn.spi.read(NM_MINIF));
+	knPutWord(w, (cat = nn.spi.read(NM_CAT)));
+	return (knTableCrc(crc, aif, cat));
+}
+
+// --------------------------------------------------------
+// Read a compact neuron record and write it to the neuron pointed by
+// the chain in SR-mode, or only skip it if write is false
+// --------------------------------------------------------
+static void knGetNeuron(NeuroShield &nn, KnStream *r, KnCompDecoder &decoder, uint16_t length, bool write) {
+	uint8_t comps[32];
+	uint16_t ncr = knGetWord(r);
+	if (write)
+		nn.spi.write(NM_NCR, ncr);
+	decoder.reset();
+	for (uint16_t pos = 0; pos < length; pos += 32) {
+		uint16_t n = ((length - pos) < 32) ? (length - pos) : 32;
+		for (uint16_t j = 0; j < n; j++)
+			comps[j] = decoder.next();
+		if (write)
+			nn.spi.writeVector(comps, n);
+	}
+	uint16_t aif = knGetWord(r);
+	uint16_t minif = knGetWord(r);
+	uint16_t cat = knGetWord(r);
+	if (write) {
+		nn.spi.write(NM_AIF, aif);
+		nn.spi.write(NM_MINIF, minif);
+		nn.spi.write(NM_CAT, cat);
+	}
+}
+
+// --------------------------------------------------------
+// Save the knowledge of the neurons to a compact knowledge file
+// (see NeuroShieldKnowledge.h) with only the first length components
+// of the neurons as bytes, delta + run-length coded if rle is set.
+// Read back by loadKnowledgeFromSDcard()
+// --------------------------------------------------------
+int NeuroShield::saveCompactKnowledgeToSDcard(char *filename, uint16_t length, bool rle) {
+	NeuroShieldPowerGuard guard(*this);
+
+	// Neuron size error
+	if ((length == 0) || (length > NEURON_SIZE)) {
+		return (5);
+	}
 
-	uint16_t header[4]{KN_FORMAT, 0, 0, 0};
-	header[1] = NEURON_SIZE;
-	int ncount = getNcount();
-	header[2] = ncount;
-	SDfile.write(header, ((sizeof(uint16_t)) * 4));
+	File SDfile;
+	int ret_val = knCreate(SD_detected, filename, SDfile);
+	if (ret_val != 0) {
+		return (ret_val);
+	}
 
-	uint16_t data, temp_nsr = getNsr();
-	setNsr(0x0010);
-	resetChain();
+	KnStream w;
+	knBeginWrite(&w, &SDfile, 0);
+	uint16_t flags = rle ? KN_FLAG_RLE : 0;
+	uint16_t ncount = spi.read(NM_NCOUNT);
+	knPutWord(&w, KN_FORMAT_COMPACT);
+	knPutWord(&w, KN_COMPACT_VERSION);
+	knPutWord(&w, length);
+	knPutWord(&w, ncount);
+	knPutWord(&w, flags);
+	knPutWord(&w, 0);
+
+	beginNeuronRead();
 	for (int i = 1; i <= ncount; i++) {
-		ncr = getNcr();
-		SDfile.write(&ncr, sizeof(uint16_t));
-		for (int j = 0; j < NEURON_SIZE; j++) {
-			data = getComp();
-			SDfile.write(&data, sizeof(uint16_t));
+		knPutNeuron(*this, &w, length, flags, 0);
+		chain_nid++;
+	}
+	endNeuronRead();
+
+	knPutWord(&w, w.crc);
+	knFlush(&w);
+	SDfile.close();
+	return (0);
+}
+
+// --------------------------------------------------------
+// Load the neurons from a compact knowledge file whose first 8 bytes
+// were read in header. The neurons are written while the file is read,
+// they are forgotten if the file turns out to be truncated or corrupted.
+// --------------------------------------------------------
+static int knLoadCompact(NeuroShield &nn, File &file, uint16_t header[4]) {
+	KnStream r;
+	knBeginRead(&r, &file, header);
+	uint16_t flags = knGetWord(&r);
+	knGetWord(&r);
+
+	// Format version not supported
+	if (header[1] > KN_COMPACT_VERSION) {
+		return (4);
+	}
+
+	// Neuron size error
+	uint16_t length = header[2];
+	if ((length == 0) || (length > NEURON_SIZE)) {
+		return (5);
+	}
+
+	// Device capacity not enough
+	uint16_t ncount = header[3];
+	if (ncount > nn.total_neurons) {
+		return (6);
+	}
+
+	KnCompDecoder decoder(flags, knGetByte, &r);
+	uint16_t temp_nsr = nn.getNsr();
+	nn.forget();
+	nn.setNsr(0x0010);
+	nn.resetChain();
+	for (uint16_t i = 0; (i < ncount) && !r.eof; i++)
+		knGetNeuron(nn, &r, decoder, length, true);
+	uint16_t crc = r.crc;
+	uint16_t file_crc = knGetWord(&r);
+	nn.setNsr(temp_nsr);
+
+	// File truncated or corrupted
+	if (r.eof || (file_crc != crc)) {
+		nn.forget();
+		return (7);
+	}
+	return (0);
+}
+
+// --------------------------------------------------------
+// Check that the last record of a checkpoint file starts at record,
+// ends at size with the CRC record_crc, and holds the neurons up to
+// ncount, so that the file is the one of the last checkpoint
+// --------------------------------------------------------
+static bool knLastRecord(File &file, uint32_t record, uint32_t size, uint16_t ncount, uint16_t record_crc) {
+	uint16_t words[3];
+	uint16_t crc;
+	if ((record < KN_CHECKPOINT_HEADER) || ((record + 8) > size)) {
+		return (false);
+	}
+	if (!file.seekSet(record) || (file.read(words, sizeof(words)) != sizeof(words))) {
+		return (false);
+	}
+	if ((words[0] == 0) || (((uint32_t)words[0] - 1 + words[1]) != ncount)) {
+		return (false);
+	}
+	if (!file.seekSet(size - 2) || (file.read(&crc, sizeof(crc)) != sizeof(crc))) {
+		return (false);
+	}
+	return (crc == record_crc);
+}
+
+// --------------------------------------------------------
+// Checkpoint the knowledge of the neurons to a checkpoint file
+// (see NeuroShieldKnowledge.h), coded as in saveCompactKnowledgeToSDcard()
+// The first checkpoint, or the first one after the neurons were
+// forgotten or loaded from a non-checkpoint file, writes a new file with
+// all the committed neurons. The next ones append a record holding the
+// neurons committed since the previous checkpoint, and the AIF and CAT
+// of the older neurons if any of them changed. A record is complete on
+// the card when the call returns, a checkpoint interrupted by a reset
+// or a power loss only loses its own record.
+// Read back by loadKnowledgeFromSDcard()
+// --------------------------------------------------------
+int NeuroShield::checkpointKnowledgeToSDcard(char *filename, uint16_t length, bool rle) {
+	NeuroShieldPowerGuard guard(*this);
+
+	// Neuron size error
+	if ((length == 0) || (length > NEURON_SIZE)) {
+		return (5);
+	}
+
+	if (!SD_detected) {
+		SD_detected = SD.begin(ARDUINO_SD_CS);
+	}
+
+	// SD card not found
+	if (!SD_detected) {
+		return (1);
+	}
+
+	uint16_t ncount = spi.read(NM_NCOUNT);
+	uint16_t flags = rle ? KN_FLAG_RLE : 0;
+	uint16_t first = 0;				// neurons already in the file
+	File SDfile;
+	if ((checkpoint_ncount > 0) && (ncount >= checkpoint_ncount) && SD.exists(filename)) {
+		SDfile = SD.open(filename, O_RDWR);
+		uint16_t header[KN_CHECKPOINT_HEADER / 2];
+		if (SDfile && (SDfile.size() >= checkpoint_size)
+			&& (SDfile.read(header, KN_CHECKPOINT_HEADER) == KN_CHECKPOINT_HEADER)
+			&& (header[0] == KN_FORMAT_CHECKPOINT) && (header[2] == length)
+			&& knLastRecord(SDfile, checkpoint_record, checkpoint_size, checkpoint_ncount, checkpoint_record_crc)) {
+			flags = header[3];
+			first = checkpoint_ncount;
+		} else if (SDfile) {
+			SDfile.close();
+		}
+	}
+
+	KnStream w;
+	beginNeuronRead();
+	uint16_t crc = knPutTable(*this, first, NULL);
+	chain_nid += first;
+	uint16_t table = ((first > 0) && (crc != checkpoint_crc)) ? first : 0;
+
+	// nothing changed since the last checkpoint
+	if ((first > 0) && (table == 0) && (ncount == first)) {
+		endNeuronRead();
+		SDfile.close();
+		return (0);
+	}
+
+	if (first == 0) {
+		int ret_val = knCreate(SD_detected, filename, SDfile);
+		if (ret_val != 0) {
+			endNeuronRead();
+			return (ret_val);
 		}
-		aif = getAif();
-		SDfile.write(&aif, sizeof(uint16_t));
-		minif = getMinif();
-		SDfile.write(&minif, sizeof(uint16_t));
-		cat = getCat();
-		SDfile.write(&cat, sizeof(uint16_t));
+		knBeginWrite(&w, &SDfile, 0);
+		knPutWord(&w, KN_FORMAT_CHECKPOINT);
+		knPutWord(&w, KN_CHECKPOINT_VERSION);
+		knPutWord(&w, length);
+		knPutWord(&w, flags);
+		knPutWord(&w, 0);
+		knPutWord(&w, w.crc);
+	} else {
+		// drop a record left incomplete by an interrupted checkpoint
+		SDfile.truncate(checkpoint_size);
+		SDfile.seekEnd();
+		knBeginWrite(&w, &SDfile, checkpoint_size);
 	}
-	setNsr(temp_nsr);
-	setPowerSave();
 
+	uint32_t record = w.offset;
+	w.crc = KN_CRC_INIT;
+	knPutWord(&w, first + 1);
+	knPutWord(&w, ncount - first);
+	knPutWord(&w, table);
+	if (table > 0) {
+		seekNeuron(1);
+		knPutTable(*this, table, &w);
+		chain_nid += table;
+	}
+	for (uint16_t i = first; i < ncount; i++) {
+		crc = knPutNeuron(*this, &w, length, flags, crc);
+		chain_nid++;
+	}
+	endNeuronRead();
+	uint16_t record_crc = w.crc;
+	knPutWord(&w, record_crc);
+	knFlush(&w);
 	SDfile.close();
+
+	checkpoint_ncount = ncount;
+	checkpoint_crc = crc;
+	checkpoint_size = w.offset;
+	checkpoint_record = record;
+	checkpoint_record_crc = record_crc;
 	return (0);
 }
+
+// --------------------------------------------------------
+// Load the neurons from a checkpoint file whose first 8 bytes were read
+// in header. The records are checked before the neurons are written,
+// and replayed up to the first one which is truncated or corrupted.
+// Returns the neuron count, table CRC and size of the valid records to
+// continue the checkpoints from there.
+// --------------------------------------------------------
+static int knLoadCheckpoint(NeuroShield &nn, File &file, uint16_t header[4], uint16_t *ncount, uint16_t *table_crc, uint32_t *size, uint32_t *last, uint16_t *last_crc) {
+	KnStream r;
+	knBeginRead(&r, &file, header);
+	knGetWord(&r);
+	uint16_t crc = r.crc;
+
+	// Header corrupted
+	if ((knGetWord(&r) != crc) || r.eof) {
+		return (7);
+	}
+
+	// Format version not supported
+	if (header[1] > KN_CHECKPOINT_VERSION) {
+		return (4);
+	}
+
+	// Neuron size error
+	uint16_t length = header[2];
+	if ((length == 0) || (length > NEURON_SIZE)) {
+		return (5);
+	}
+
+	KnCompDecoder decoder(header[3], knGetByte, &r);
+	uint16_t records = 0, count = 0;
+	uint32_t end = r.offset;
+	uint32_t record = 0;
+	bool capacity = true;
+	while (!r.eof) {
+		uint32_t start = r.offset;
+		r.crc = KN_CRC_INIT;
+		uint16_t first = knGetWord(&r);
+		uint16_t n = knGetWord(&r);
+		uint16_t table = knGetWord(&r);
+		if (r.eof || (first != (count + 1)) || ((table != 0) && (table != count)))
+			break;
+		if (((uint32_t)count + n) > nn.total_neurons) {
+			capacity = false;
+			break;
+		}
+		for (uint16_t i = 0; (i < table) && !r.eof; i++) {
+			knGetWord(&r);
+			knGetWord(&r);
+		}
+		for (uint16_t i = 0; (i < n) && !r.eof; i++)
+			knGetNeuron(nn, &r, decoder, length, false);
+		crc = r.crc;
+		if ((knGetWord(&r) != crc) || r.eof)
+			break;
+		records++;
+		count += n;
+		end = r.offset;
+		record = start;
+		*last_crc = crc;
+	}
+
+	// Device capacity not enough, or no complete record
+	if (records == 0) {
+		return (capacity ? 7 : 6);
+	}
+
+	file.seekSet(KN_CHECKPOINT_HEADER);
+	r.len = 0;
+	r.pos = 0;
+	r.eof = false;
+	uint16_t temp_nsr = nn.getNsr();
+	nn.forget();
+	nn.setNsr(0x0010);
+	for (uint16_t k = 0; k < records; k++) {
+		uint16_t first = knGetWord(&r);
+		uint16_t n = knGetWord(&r);
+		uint16_t table = knGetWord(&r);
+		nn.resetChain();
+		for (uint16_t i = 1; i < first; i++) {
+			if (table > 0) {
+				nn.spi.write(NM_AIF, knGetWord(&r));
+				nn.spi.write(NM_CAT, knGetWord(&r));
+			} else {
+				nn.spi.read(NM_CAT);
+			}
+		}
+		for (uint16_t i = 0; i < n; i++)
+			knGetNeuron(nn, &r, decoder, length, true);
+		knGetWord(&r);
+	}
+	nn.resetChain();
+	*table_crc = knPutTable(nn, count, NULL);
+	nn.setNsr(temp_nsr);
+	*ncount = count;
+	*size = end;
+	*last = record;
+	return (0);
+}
+
 // --------------------------------------------------------
 // Load the neurons with a knowledge stored in a knowledge file
 // saved in a format compatible with the NeuroMem API
+// or in the compact format of saveCompactKnowledgeToSDcard()
+// or checkpointKnowledgeToSDcard()
+// The file is read by KN_BUFFER_SIZE blocks and the components
+// of each neuron are written in burst-mode
+// Returns 7 if a compact file is truncated or fails its CRC, or if a
+// checkpoint file has no complete record
 // --------------------------------------------------------
 int NeuroShield::loadKnowledgeFromSDcard(char *filename) {
+	NeuroShieldPowerGuard guard(*this);
 	if (!SD_detected) {
 		SD_detected = SD.begin(ARDUINO_SD_CS);
 	}
@@ -752,6 +1989,21 @@ int NeuroShield::loadKnowledgeFromSDcard(char *filename) {
 	uint16_t header[4];
 	SDfile.read(header, ((sizeof(uint16_t)) * 4));
 
+	if (header[0] == KN_FORMAT_COMPACT) {
+		int ret_val = knLoadCompact(*this, SDfile, header);
+		if (ret_val == 0)
+			countNeurons(header[3]);
+		SDfile.close();
+		return (ret_val);
+	}
+
+	if (header[0] == KN_FORMAT_CHECKPOINT) {
+		int ret_val = knLoadCheckpoint(*this, SDfile, header, &checkpoint_ncount, &checkpoint_crc, &checkpoint_size, &checkpoint_record, &checkpoint_record_crc);
+		countNeurons(checkpoint_ncount);
+		SDfile.close();
+		return (ret_val);
+	}
+
 	// Magic number not matched
 	if (header[0] < KN_FORMAT) {
 		return (4);
@@ -762,39 +2014,56 @@ int NeuroShield::loadKnowledgeFromSDcard(char *filename) {
 		return (5);
 	}
 
-	int ncount = 0;
-
 	// Device capacity not enough
 	if (header[2] > total_neurons) {
 		return (6);
 	}
 
-	// incompatible neuron size
-	ncount = header[2];
-
-	uint16_t data, temp_nsr = getNsr();
-	forget();
-	setNsr(0x0010);
-	resetChain();
-	while (SDfile.available()) {
-		for (int i = 1; i <= ncount; i++) {
-			SDfile.read(&data, sizeof(uint16_t));
-			setNcr(data);
-			for (int j = 0; j < NEURON_SIZE; j++) {
-				SDfile.read(&data, sizeof(uint16_t));
-				setComp(data);
-			}
-			SDfile.read(&data, sizeof(uint16_t));
-			setAif(data);
-			SDfile.read(&data, sizeof(uint16_t));
-			setMinif(data);
-			SDfile.read(&data, sizeof(uint16_t));
-			setCat(data);
-		}
-		break;
+	// each neuron is stored as NCR, header[1] * COMP, AIF, MINIF, CAT
+	uint16_t length = header[1];
+	uint32_t words = (uint32_t)header[2] * (length + 4);
+
+	uint16_t buffer[KN_BUFFER_SIZE / 2];
+	beginRestore(length, false);
+	while (words > 0) {
+		int read_len = SDfile.read(buffer, KN_BUFFER_SIZE);
+		if (read_len < (int)sizeof(uint16_t))
+			break;
+		uint16_t n = read_len / sizeof(uint16_t);
+		if (n > words)
+			n = words;
+		restoreRecords(buffer, n);
+		words -= n;
 	}
-	setNsr(temp_nsr);
+	endRestore();
 
 	SDfile.close();
 	return (0);
-}
\ No newline at end of file
+}
+
+#else
+
+// --------------------------------------------------------
+// Built without SD card support: SD card not found
+// --------------------------------------------------------
+int NeuroShield::saveKnowledgeToSDcard(char *) {
+	return (1);
+}
+
+int NeuroShield::saveKnowledgeToSDcard(char *, uint16_t) {
+	return (1);
+}
+
+int NeuroShield::saveCompactKnowledgeToSDcard(char *, uint16_t, bool) {
+	return (1);
+}
+
+int NeuroShield::checkpointKnowledgeToSDcard(char *, uint16_t, bool) {
+	return (1);
+}
+
+int NeuroShield::loadKnowledgeFromSDcard(char *) {
+	return (1);
+}
+
+#endif
\ No newline at end of file
@@ -72,7 +72,11 @@ extern "C" {
 
 #define NEURON_SIZE 	256		// memory capacity of each neuron in byte.
 
-#define POWERSAVE		spi.write(NM_POWERSAVE, 1)
+// power-save policy, see setPowerPolicy()
+#define NM_POWERSAVE_EACH		0		// enter power-save at the end of every call (default)
+#define NM_POWERSAVE_DEFERRED	1		// enter power-save only on idle()
+
+#define POWERSAVE		powerSave()
 
 #define ARDUINO_CON		5		// SPI_SEL
 #define ARDUINO_SD_CS	6		// SDCARD_SSn
@@ -80,13 +84,89 @@ extern "C" {
 
 #define KN_FORMAT		0x1704	// Magic Number
 
+// components sent by each poll() of classifyAsync(), one buffered transfer by default
+#ifndef NM_ASYNC_CHUNK
+#define NM_ASYNC_CHUNK		((NM500_SPI_FRAME_SIZE - 8) / 2)
+#endif
+
+// begin() flags
+#define NM_BEGIN_FAST		0x01	// poll the NM500 readiness, reuse the cached neuron count, clear at the first learn
+#define NM_BEGIN_AUTO_CLOCK	0x02	// select the fastest reliable spi clock, see setSpiClock()
+
+// location of the neuron count cache in EEPROM (6 bytes), see NM_BEGIN_FAST
+// The cache survives a power cycle on AVR only, elsewhere it is kept in
+// RAM and the first fast boot of each run counts the neurons.
+#if defined(__AVR__) && !defined(NEUROSHIELD_EEPROM_ADDR)
+#define NEUROSHIELD_EEPROM_ADDR	(E2END - 5)
+#endif
+
+// knowledge files on the SD card (SdFat), available by default on Arduino
+#ifndef NEUROSHIELD_SDCARD
+#if defined(ARDUINO)
+#define NEUROSHIELD_SDCARD	1
+#else
+#define NEUROSHIELD_SDCARD	0
+#endif
+#endif
+
+// size of the SD card transfer buffer in byte (one sector, smaller on AVR)
+#ifndef KN_BUFFER_SIZE
+#if defined(__AVR__)
+#define KN_BUFFER_SIZE	128
+#else
+#define KN_BUFFER_SIZE	512
+#endif
+#endif
+
 class NeuroShield
 {
 	public:
 
+		// response of the top firing neuron to a vector, see classifyBatch()
+		struct Result {
+			uint16_t status;		// NSR, 0=unknown, 4=uncertain, 8=identified
+			uint16_t dist;			// 0xFFFF if no neuron fires
+			uint16_t cat;
+			uint16_t nid;
+		};
+
+		// registers of a neuron read along with its components in 8-bit,
+		// see readNeuron()
+		struct Neuron {
+			uint16_t ncr;
+			uint16_t aif;
+			uint16_t minif;
+			uint16_t cat;
+		};
+
+		// outcome of a training set, see learnBatch()
+		struct LearnStats {
+			uint16_t committed;		// neurons committed by the batch
+			uint16_t shrunk;		// vectors which reduced the AIF of neurons of another category
+		};
+
+#if NEUROSHIELD_STATS
+		// recognitions and learning since the last resetStats()
+		struct Stats {
+			uint32_t classified;	// vectors recognized by classify(), classifyBatch() and classifyAsync()
+			uint32_t identified;	// ... with the ID status
+			uint32_t uncertain;		// ... with the UNC status
+			uint32_t unknown;		// ... with no firing neuron
+			uint32_t learned;		// vectors learned
+			uint32_t committed;		// neurons committed by learning
+		};
+#endif
+
+		// completion of classifyAsync()
+		typedef void (*ClassifyCallback)(void* ctx, const Result& result);
+
+		// a committed neuron, see forEachNeuron(), false stops the iteration
+		typedef bool (*NeuronCallback)(void* ctx, uint16_t nid, const Neuron& neuron, const uint8_t comps[], uint16_t length);
+
 		NeuroShield();
 		uint16_t begin();
 		uint16_t begin(uint8_t slave_select);
+		uint16_t begin(uint8_t slave_select, uint8_t flags);
 		
 		void setNcr(uint16_t value);
 		uint16_t getNcr();
@@ -111,6 +191,10 @@ class NeuroShield
 		uint16_t getNsr();
 		uint16_t getNcount();
 		void setPowerSave();
+		void setPowerPolicy(uint8_t policy);
+		void holdPowerSave();
+		void releasePowerSave();
+		void idle();
 		void forget();
 		void forget(uint16_t maxif);
 		
@@ -120,29 +204,60 @@ class NeuroShield
 		void setContext(uint8_t context);
 		void setContext(uint8_t context, uint16_t minif, uint16_t maxif);
 		void getContext(uint8_t* context, uint16_t* minif, uint16_t* maxif);
+		void resync();
 		void setRbfClassifier();
 		void setKnnClassifier();
 		
 		uint16_t broadcast(uint8_t vector[], uint16_t length);
 		uint16_t learn(uint8_t vector[], uint16_t length, uint16_t category);
+		uint16_t learnBatch(const uint8_t* vectors, uint16_t count, uint16_t length, const uint16_t categories[], LearnStats* stats);
 		uint16_t classify(uint8_t vector[], uint16_t length);
 		uint16_t classify(uint8_t vector[], uint16_t length, uint16_t* distance, uint16_t* category, uint16_t* nid);
 		uint16_t classify(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[]);
+		uint16_t classify(uint8_t vector[], uint16_t length, uint16_t k, Result results[]);
+		uint16_t classifyDistances(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[]);
+		uint16_t classifyBatch(const uint8_t* vectors, uint16_t count, uint16_t length, Result* out);
+		bool classifyAsync(const uint8_t* vector, uint16_t length, ClassifyCallback callback, void* ctx);
+		bool poll();
+		bool busy();
 		
+		void beginNeuronRead();
+		void endNeuronRead();
 		void readNeuron(uint16_t nid, uint16_t model[], uint16_t* ncr, uint16_t* aif, uint16_t* cat);
 		void readNeuron(uint16_t nid, uint16_t nuerons[]);
+		void readNeuron(uint16_t nid, uint16_t neuron[], uint16_t length);
+		void readNeuron(uint16_t nid, Neuron* neuron, uint8_t comps[], uint16_t length);
 		uint16_t readNeurons(uint16_t neurons[]);
+		uint16_t readNeurons(uint16_t first, uint16_t count, uint16_t neurons[]);
+		uint16_t readNeurons(uint16_t first, uint16_t count, uint16_t neurons[], uint16_t length);
+		uint16_t readNeurons(uint16_t first, uint16_t count, Neuron neurons[], uint8_t comps[], uint16_t length);
+		uint16_t forEachNeuron(NeuronCallback callback, void* ctx);
+		uint16_t forEachNeuron(NeuronCallback callback, void* ctx, uint16_t length);
 		void readCompVector(uint16_t* data, uint16_t size);
+		void readCompVector(uint8_t* data, uint16_t size);
 		void writeNeurons(uint16_t neurons[], uint16_t ncount);
+		void writeNeurons(uint16_t neurons[], uint16_t ncount, uint16_t length);
 		void writeCompVector(uint16_t* data, uint16_t size);
+		void beginRestore(uint16_t length, bool clear = true);
+		void restoreRecords(const uint16_t* words, uint16_t count);
+		uint16_t endRestore();
 		
 		uint16_t testCommand(uint8_t read_write, uint8_t reg, uint16_t data);
 		
+		void setSpiClock(uint32_t clock);
+		uint32_t getSpiClock();
+		
 		uint16_t fpgaVersion();
 		void nm500Reset();
 		void ledSelect(uint8_t data);
 		
+#if NEUROSHIELD_STATS
+		void getStats(Stats* out);
+		void resetStats();
+#endif
+		
 		uint16_t total_neurons;
+		NeuroShieldSPI spi;				// SPI link to the NM500 of this shield
 
 		//-----------------------------------
 		// Access to SD card
@@ -150,9 +265,77 @@ class NeuroShield
 		bool SD_detected = false;
 		// compatible with the NeuroMem knowledge Studio knowledge files (.knf)
 		int saveKnowledgeToSDcard(char* filename);
+		int saveKnowledgeToSDcard(char* filename, uint16_t length);
+		int saveCompactKnowledgeToSDcard(char* filename, uint16_t length, bool rle);
+		int checkpointKnowledgeToSDcard(char* filename, uint16_t length, bool rle);
 		int loadKnowledgeFromSDcard(char* filename);
 
 	private:
 		uint16_t support_burst_read = 0;
+		uint16_t start(uint8_t slave_select, uint8_t flags);
+		uint16_t readTotalNeurons(uint16_t fpga_version);
+		bool clear_pending = false;		// neuron memory not cleared since a fast boot
+		void clearIfPending();
+		
+		uint8_t power_policy = NM_POWERSAVE_EACH;
+		uint8_t power_hold = 0;
+		bool power_pending = false;
+		void powerSave();
+		
+		uint8_t cursor_open = 0;
+		uint16_t cursor_nsr = 0;
+		uint16_t chain_nid = 0;			// neuron pointed by the chain in SR-mode, 0 if unknown
+		void seekNeuron(uint16_t nid);
+		void readNeuronData(uint16_t neuron[], uint16_t length);
+		void readNeuronData(Neuron* neuron, uint8_t comps[], uint16_t length);
+		bool readoutStarts(uint16_t nsr);
+		bool readResponse(bool& more, uint16_t* distance, uint16_t* category, uint16_t* nid);
+		
+		uint16_t restore_nsr = 0;
+		uint16_t restore_length = 0;
+		uint16_t restore_field = 0;		// next word of the current record
+		uint16_t restore_count = 0;		// neurons written
+		
+		uint8_t async_state = 0;		// step of the pending classifyAsync(), 0 if none
+		uint16_t async_length;
+		uint16_t async_pos;
+		const uint8_t* async_vector;
+		ClassifyCallback async_callback;
+		void* async_ctx;
+		Result async_result;
+		void completeAsync();
+		
+#if NEUROSHIELD_STATS
+		Stats stats;
+		uint16_t stats_ncount = 0;		// neurons seen committed by the last call
+		void countClassify(uint16_t status);
+		void countLearn(uint16_t count, uint16_t ncount);
+		void countNeurons(uint16_t ncount);
+#else
+		void countClassify(uint16_t) {}
+		void countLearn(uint16_t, uint16_t) {}
+		void countNeurons(uint16_t) {}
+#endif
+		
+		uint16_t checkpoint_ncount = 0;	// neurons in the last checkpoint file, 0 if none
+		uint16_t checkpoint_crc = 0;	// CRC of their AIF and CAT
+		uint32_t checkpoint_size = 0;	// size of the valid records of the file
+		uint32_t checkpoint_record = 0;	// offset of its last record
+		uint16_t checkpoint_record_crc = 0;	// CRC of its last record
+};
+
+// ------------------------------------------------------------
+// Scoped power-save guard
+// The calls made while the guard is alive share a single power-save
+// command, issued when the guard goes out of scope.
+// ------------------------------------------------------------
+class NeuroShieldPowerGuard
+{
+	public:
+		NeuroShieldPowerGuard(NeuroShield& neuroshield) : nn(neuroshield) { nn.holdPowerSave(); }
+		~NeuroShieldPowerGuard() { nn.releasePowerSave(); }
+		
+	private:
+		NeuroShield& nn;
 };
 #endif
@@ -0,0 +1,389 @@
+/*
+ * NeuroShieldArray.cpp - Several NeuroShields used as one network
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NeuroShield.h>
+#include <NeuroShieldArray.h>
+#if !defined(NM500_EMULATOR)
+#include <Arduino.h>
+#endif
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// ------------------------------------------------------------
+//    Constructor to the class NeuroShieldArray
+// ------------------------------------------------------------
+NeuroShieldArray::NeuroShieldArray() {
+}
+
+// ------------------------------------------------------------
+// Initialize the shields selected by the given pins, in this order
+// 0:fail,  other: success(return total_neurons of all the shields)
+// ------------------------------------------------------------
+uint16_t NeuroShieldArray::begin(const uint8_t slave_select[], uint8_t count) {
+	if (count > NM_ARRAY_MAX_CHIPS)
+		count = NM_ARRAY_MAX_CHIPS;
+
+#if !defined(NM500_EMULATOR)
+	// release every shield before talking to the first one
+	for (uint8_t i = 0; i < count; i++) {
+		pinMode(slave_select[i], OUTPUT);
+		digitalWrite(slave_select[i], HIGH);
+	}
+#endif
+
+	chip_count = 0;
+	total_neurons = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		if (chips[i].begin(slave_select[i]) == 0)
+			return (0);
+		first_nid[i] = total_neurons;
+		total_neurons += chips[i].total_neurons;
+		chip_count++;
+	}
+	learn_chip = 0;
+	maxif = 0x4000;
+	return (total_neurons);
+}
+
+// ------------------------------------------------------------
+// Access to the shields of the array
+// After committing neurons on a shield directly, call getNcount()
+// so that the array finds the first shield with free neurons again.
+// ------------------------------------------------------------
+uint8_t NeuroShieldArray::chipCount() {
+	return (chip_count);
+}
+
+NeuroShield& NeuroShieldArray::chip(uint8_t index) {
+	return (chips[index]);
+}
+
+// ------------------------------------------------------------
+// The calls made on the shields during an operation of the array
+// share a single power-save command per shield
+// ------------------------------------------------------------
+void NeuroShieldArray::hold() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].holdPowerSave();
+}
+
+void NeuroShieldArray::release() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].releasePowerSave();
+}
+
+void NeuroShieldArray::setPowerPolicy(uint8_t policy) {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].setPowerPolicy(policy);
+}
+
+void NeuroShieldArray::idle() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].idle();
+}
+
+// ------------------------------------------------------------
+// Read the number of committed neurons of all the shields
+// ------------------------------------------------------------
+uint16_t NeuroShieldArray::getNcount() {
+	uint16_t ncount = 0;
+	learn_chip = chip_count;
+	for (uint8_t c = 0; c < chip_count; c++) {
+		uint16_t chip_ncount = chips[c].getNcount();
+		if ((chip_ncount < chips[c].total_neurons) && (learn_chip == chip_count))
+			learn_chip = c;
+		ncount += chip_ncount;
+	}
+	return (ncount);
+}
+
+// ------------------------------------------------------------
+// Un-commit all the neurons of all the shields
+// ------------------------------------------------------------
+void NeuroShieldArray::forget() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].forget();
+	learn_chip = 0;
+	maxif = 0x4000;
+}
+
+void NeuroShieldArray::forget(uint16_t value) {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].forget(value);
+	learn_chip = 0;
+	maxif = value;
+}
+
+// ------------------------------------------------------------
+// Set the context and the classifier of all the shields
+// ------------------------------------------------------------
+void NeuroShieldArray::setContext(uint8_t context) {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].setContext(context);
+}
+
+void NeuroShieldArray::setContext(uint8_t context, uint16_t minif, uint16_t value) {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].setContext(context, minif, value);
+	maxif = value;
+}
+
+void NeuroShieldArray::setRbfClassifier() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].setRbfClassifier();
+}
+
+void NeuroShieldArray::setKnnClassifier() {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chips[c].setKnnClassifier();
+}
+
+// ------------------------------------------------------------
+// Send a vector to all the shields and keep their status
+// ------------------------------------------------------------
+void NeuroShieldArray::send(uint8_t vector[], uint16_t length) {
+	for (uint8_t c = 0; c < chip_count; c++)
+		chip_nsr[c] = chips[c].broadcast(vector, length);
+}
+
+// ------------------------------------------------------------
+// Merge the responses of the shields by increasing distance into up to
+// k entries, the neuron identifiers are made global.
+// When nsr is given, it receives the status of the array: uncertain if
+// a shield is uncertain or two shields identify different categories,
+// identified if the shields which recognize the vector agree.
+// Return the number of entries filled
+// ------------------------------------------------------------
+uint16_t NeuroShieldArray::readout(uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[], uint16_t *nsr) {
+	uint16_t recog_nbr = 0;
+	uint16_t status = 0;
+	uint16_t id_cat = 0xFFFF;
+
+	for (uint8_t c = 0; c < chip_count; c++) {
+		bool identified = (nsr != nullptr) && ((chip_nsr[c] & 0x0008) != 0);
+		if (chip_nsr[c] & 0x0004)
+			status = 0x0004;
+		for (uint16_t i = 0; ; i++) {
+			uint16_t dist = chips[c].getDist();
+			if (dist == 0xFFFF)
+				break;
+			// the responses of a shield come by increasing distance
+			bool keep = (recog_nbr < k) || ((k > 0) && (dist < distance[k - 1]));
+			if (!keep && ((i > 0) || !identified))
+				break;
+			uint16_t cat = chips[c].getCat();
+			if ((i == 0) && identified) {
+				if (id_cat == 0xFFFF)
+					id_cat = cat & 0x7FFF;
+				else if ((cat & 0x7FFF) != id_cat)
+					status = 0x0004;
+			}
+			if (!keep)
+				break;
+			uint16_t id = chips[c].getNid() + first_nid[c];
+			uint16_t pos = (recog_nbr < k) ? recog_nbr++ : (k - 1);
+			while ((pos > 0) && (distance[pos - 1] > dist)) {
+				distance[pos] = distance[pos - 1];
+				category[pos] = category[pos - 1];
+				nid[pos] = nid[pos - 1];
+				pos--;
+			}
+			distance[pos] = dist;
+			category[pos] = cat;
+			nid[pos] = id;
+		}
+	}
+	for (uint16_t i = recog_nbr; i < k; i++) {
+		distance[i] = 0xFFFF;
+		category[i] = 0xFFFF;
+		nid[i] = 0xFFFF;
+	}
+
+	if (nsr != nullptr) {
+		if ((status == 0) && (id_cat != 0xFFFF))
+			status = 0x0008;
+		*nsr = (chip_nsr[0] & ~0x000C) | status;
+	}
+	return (recog_nbr);
+}
+
+// --------------------------------------------------------
+// Broadcast a vector to the shields and return the recognition status
+// 0=unknown, 4=uncertain, 8=Identified
+//---------------------------------------------------------
+uint16_t NeuroShieldArray::broadcast(uint8_t vector[], uint16_t length) {
+	uint16_t ret_val;
+	hold();
+	send(vector, length);
+	readout(0, nullptr, nullptr, nullptr, &ret_val);
+	release();
+	return (ret_val);
+}
+
+// ------------------------------------------------------------
+// Distance of the closest in-context neuron of another category on the
+// full shields, firing or not, or limit if none is closer. Each full
+// shield gets the vector again in KNN mode, where all the neurons of
+// the context respond by increasing distance.
+// ------------------------------------------------------------
+uint16_t NeuroShieldArray::closestOther(uint8_t vector[], uint16_t length, uint16_t category, uint16_t limit) {
+	for (uint8_t c = 0; (c < learn_chip) && (c < chip_count); c++) {
+		bool knn = (chips[c].spi.readShadow(NM_NSR) & 0x0020) != 0;
+		if (!knn)
+			chips[c].setKnnClassifier();
+		chips[c].broadcast(vector, length);
+		while (true) {
+			uint16_t dist = chips[c].getDist();
+			if ((dist == 0xFFFF) || (dist >= limit))
+				break;
+			if ((chips[c].getCat() & 0x7FFF) != category) {
+				limit = dist;
+				break;
+			}
+		}
+		if (!knn)
+			chips[c].setRbfClassifier();
+	}
+	return (limit);
+}
+
+//-----------------------------------------------
+// Learn a vector using the current context value
+// The full shields before the one which receives the new neurons only
+// shrink their firing neurons. The shields after it are empty.
+// Return the number of committed neurons of the array
+//----------------------------------------------
+uint16_t NeuroShieldArray::learn(uint8_t vector[], uint16_t length, uint16_t category) {
+	bool recognized = false;		// by a full shield
+	bool recognized_here = false;	// by the learning shield
+	uint16_t ret_val;
+
+	hold();
+	uint16_t limit = closestOther(vector, length, category, maxif);
+	send(vector, length);
+	for (uint8_t c = 0; (c <= learn_chip) && (c < chip_count); c++) {
+		bool full = (c < learn_chip);
+		if ((chip_nsr[c] & 0x000C) == 0)
+			continue;
+		// the learning shield matters only if a full one recognizes the vector
+		if (!full && !recognized)
+			continue;
+		while (!(full ? recognized : recognized_here)) {
+			uint16_t dist = chips[c].getDist();
+			if (dist == 0xFFFF)
+				break;
+			if ((chips[c].getCat() & 0x7FFF) == category) {
+				if (full)
+					recognized = true;
+				else
+					recognized_here = true;
+			}
+		}
+	}
+	for (uint8_t c = 0; c < learn_chip; c++)
+		chips[c].setCat(category);
+	if (learn_chip < chip_count) {
+		NeuroShield &nn = chips[learn_chip];
+		if (!recognized || recognized_here) {
+			if (limit < maxif)
+				nn.setMaxif(limit);
+			nn.setCat(category);
+			if (limit < maxif)
+				nn.setMaxif(maxif);
+		} else {
+			// recognized by a full shield only: shrink without committing
+			nn.setCat(0);
+		}
+		uint16_t ncount = nn.getNcount();
+		ret_val = first_nid[learn_chip] + ncount;
+		if (ncount >= nn.total_neurons)
+			learn_chip++;
+	} else {
+		ret_val = total_neurons;
+	}
+	release();
+	return (ret_val);
+}
+
+// ---------------------------------------------------------
+// Classify a vector and return its classification status
+// NSR=0, unknown
+// NSR=8, identified
+// NSR=4, uncertain
+// ---------------------------------------------------------
+uint16_t NeuroShieldArray::classify(uint8_t vector[], uint16_t length) {
+	return (broadcast(vector, length));
+}
+
+//----------------------------------------------
+// Recognize a vector and return the classification status, and the
+// category, distance and global identifier of the top firing neuron
+//----------------------------------------------
+uint16_t NeuroShieldArray::classify(uint8_t vector[], uint16_t length, uint16_t *distance, uint16_t *category, uint16_t *nid) {
+	uint16_t ret_val;
+	hold();
+	send(vector, length);
+	readout(1, distance, category, nid, &ret_val);
+	release();
+	return (ret_val);
+}
+
+//----------------------------------------------
+// Recognize a vector and return the response of up to K top firing
+// neurons of all the shields, by increasing distance
+// Return the number of firing neurons or K whichever is smaller
+//----------------------------------------------
+uint16_t NeuroShieldArray::classify(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[]) {
+	uint16_t recog_nbr;
+	hold();
+	send(vector, length);
+	recog_nbr = readout(k, distance, category, nid, nullptr);
+	release();
+	return (recog_nbr);
+}
+
+//-------------------------------------------------------------
+// Read the contents of the neuron of global identifier nid
+// NCR, NEURON_SIZE * COMP, AIF, MINIF, CAT
+//-------------------------------------------------------------
+void NeuroShieldArray::readNeuron(uint16_t nid, uint16_t neuron[]) {
+	uint8_t c = chip_count;
+	while ((c > 0) && (nid <= first_nid[c - 1]))
+		c--;
+	if (c == 0) {
+		chips[0].readNeuron(0, neuron);
+		return;
+	}
+	chips[c - 1].readNeuron(nid - first_nid[c - 1], neuron);
+}
@@ -0,0 +1,113 @@
+/*
+ * NeuroShieldArray.h - Several NeuroShields used as one network
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NEUROSHIELDARRAY_H
+#define _NEUROSHIELDARRAY_H
+
+#include <NeuroShield.h>
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// maximum number of shields of an array
+#ifndef NM_ARRAY_MAX_CHIPS
+#if defined(__AVR__)
+#define NM_ARRAY_MAX_CHIPS	2
+#else
+#define NM_ARRAY_MAX_CHIPS	4
+#endif
+#endif
+
+// ------------------------------------------------------------
+// NeuroShieldArray
+// Pools the neurons of several NeuroShields, each on its own slave
+// select, behind the learn/classify interface of a single one.
+// - the chips are filled one after the other, the neuron identifiers
+//   run across the chips (the first neuron of the second chip follows
+//   the last neuron of the first one)
+// - a vector is broadcast to every chip, one frame per chip: selecting
+//   several shields at once would let their FPGAs drive MISO together
+// - the responses of the chips are merged by increasing distance
+// Learning keeps the NM500 rules across the chips: the firing neurons
+// of another category shrink on every chip, and no neuron is committed
+// when a neuron of any chip already recognizes the category (the chip
+// which would commit it then learns the category 0, which only shrinks). The AIF
+// of a new neuron is limited by the closest neuron of another category
+// of the full chips in the context, firing or not.
+// ------------------------------------------------------------
+class NeuroShieldArray
+{
+	public:
+		
+		NeuroShieldArray();
+		uint16_t begin(const uint8_t slave_select[], uint8_t count);
+		
+		uint8_t chipCount();
+		NeuroShield& chip(uint8_t index);
+		
+		uint16_t getNcount();
+		void forget();
+		void forget(uint16_t maxif);
+		void setContext(uint8_t context);
+		void setContext(uint8_t context, uint16_t minif, uint16_t maxif);
+		void setRbfClassifier();
+		void setKnnClassifier();
+		void setPowerPolicy(uint8_t policy);
+		void idle();
+		
+		uint16_t broadcast(uint8_t vector[], uint16_t length);
+		uint16_t learn(uint8_t vector[], uint16_t length, uint16_t category);
+		uint16_t classify(uint8_t vector[], uint16_t length);
+		uint16_t classify(uint8_t vector[], uint16_t length, uint16_t* distance, uint16_t* category, uint16_t* nid);
+		uint16_t classify(uint8_t vector[], uint16_t length, uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[]);
+		
+		void readNeuron(uint16_t nid, uint16_t neuron[]);
+		
+		uint16_t total_neurons = 0;
+		
+	private:
+		NeuroShield chips[NM_ARRAY_MAX_CHIPS];
+		uint16_t first_nid[NM_ARRAY_MAX_CHIPS];	// global identifier of the neuron 1 of each chip, minus 1
+		uint16_t chip_nsr[NM_ARRAY_MAX_CHIPS];	// status of each chip after the last broadcast
+		uint8_t chip_count = 0;
+		uint8_t learn_chip = 0;				// first chip with free neurons
+		uint16_t maxif = 0x4000;
+		
+		void hold();
+		void release();
+		void send(uint8_t vector[], uint16_t length);
+		uint16_t closestOther(uint8_t vector[], uint16_t length, uint16_t category, uint16_t limit);
+		uint16_t readout(uint16_t k, uint16_t distance[], uint16_t category[], uint16_t nid[], uint16_t* nsr);
+};
+
+#endif // _NEUROSHIELDARRAY_H
@@ -0,0 +1,194 @@
+/*
+ * NeuroShieldFeatures.h - Sliding-window features of sensor channels
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NEUROSHIELDFEATURES_H
+#define _NEUROSHIELDFEATURES_H
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// ------------------------------------------------------------
+// NeuroShieldFeatures<Channels, Window>
+// Keeps the last Window samples of Channels sensor channels in a ring
+// buffer and their minimum and maximum over the window, updated at
+// each sample with a monotonic queue per channel (amortized O(1), no
+// rescan of the window). Once the window is full, a feature vector
+// can be made after every sample, so that successive vectors come
+// from overlapping windows:
+//
+//   NeuroShieldFeatures<6, 21> motion;
+//   motion.push(sample);
+//   if (motion.ready()) {
+//       motion.scaleRanges(0, 3, &vector[0]);
+//       hnn.broadcast(vector, 3);
+//   }
+//
+// RAM: Channels * Window * 4 bytes plus a few per channel.
+// ------------------------------------------------------------
+template <uint8_t Channels, uint8_t Window>
+class NeuroShieldFeatures
+{
+	static_assert((Channels > 0) && (Window > 0), "Channels and Window must be at least 1");
+
+	public:
+		NeuroShieldFeatures() {
+			clear();
+		}
+
+		// forget the samples
+		void clear() {
+			head = 0;
+			count = 0;
+			for (uint8_t c = 0; c < Channels; c++) {
+				min_queue[c].first = 0;
+				min_queue[c].size = 0;
+				max_queue[c].first = 0;
+				max_queue[c].size = 0;
+			}
+		}
+
+		// true once Window samples were pushed
+		bool ready() {
+			return (count == Window);
+		}
+
+		int16_t getMin(uint8_t channel) {
+			return (samples[channel][min_queue[channel].front()]);
+		}
+
+		int16_t getMax(uint8_t channel) {
+			return (samples[channel][max_queue[channel].front()]);
+		}
+
+		uint16_t getRange(uint8_t channel) {
+			return ((uint16_t)(getMax(channel) - getMin(channel)));
+		}
+
+		void push(const int16_t sample[Channels]);
+		uint16_t scaleRanges(uint8_t first, uint8_t number, uint8_t out[]);
+
+	private:
+		// positions in the ring buffer of the candidates of a channel,
+		// oldest first, themselves kept in a ring of Window entries
+		struct Queue {
+			uint8_t pos[Window];
+			uint8_t first;
+			uint8_t size;
+
+			uint8_t front() {
+				return (pos[first]);
+			}
+			uint8_t back() {
+				return (pos[(first + size - 1) % Window]);
+			}
+			void popFront() {
+				first = (first + 1) % Window;
+				size--;
+			}
+			void pushBack(uint8_t p) {
+				pos[(first + size) % Window] = p;
+				size++;
+			}
+		};
+
+		int16_t samples[Channels][Window];
+		Queue min_queue[Channels];			// increasing values
+		Queue max_queue[Channels];			// decreasing values
+		uint8_t head;						// position of the next sample, the oldest once full
+		uint8_t count;						// samples in the window
+};
+
+// ------------------------------------------------------------
+// Add a sample of every channel, the oldest one leaves the window
+// once it is full. The values a new one hides (not smaller for the
+// minimum, not larger for the maximum) are dropped from the queues.
+// ------------------------------------------------------------
+template <uint8_t Channels, uint8_t Window>
+void NeuroShieldFeatures<Channels, Window>::push(const int16_t sample[Channels])
+{
+	for (uint8_t c = 0; c < Channels; c++) {
+		Queue& mins = min_queue[c];
+		Queue& maxs = max_queue[c];
+		int16_t value = sample[c];
+
+		if (count == Window) {
+			if (mins.front() == head)
+				mins.popFront();
+			if (maxs.front() == head)
+				maxs.popFront();
+		}
+		samples[c][head] = value;
+		while ((mins.size > 0) && (samples[c][mins.back()] >= value))
+			mins.size--;
+		mins.pushBack(head);
+		while ((maxs.size > 0) && (samples[c][maxs.back()] <= value))
+			maxs.size--;
+		maxs.pushBack(head);
+	}
+	head = (head + 1) % Window;
+	if (count < Window)
+		count++;
+}
+
+// ------------------------------------------------------------
+// Range (max - min) over the window of the channels first to
+// first + number - 1, scaled to 0..255 relative to the largest of
+// them, in out[0] to out[number - 1]. The scale is a 16.16 fixed-point
+// reciprocal of the largest range, so each channel costs a multiply
+// instead of a division, the result is within 1 of range * 255 / largest.
+// Return the largest range, all out are 0 if it is 0.
+// ------------------------------------------------------------
+template <uint8_t Channels, uint8_t Window>
+uint16_t NeuroShieldFeatures<Channels, Window>::scaleRanges(uint8_t first, uint8_t number, uint8_t out[])
+{
+	uint16_t largest = 0;
+
+	for (uint8_t i = 0; i < number; i++) {
+		uint16_t range = getRange(first + i);
+		if (range > largest)
+			largest = range;
+	}
+	if (largest == 0) {
+		for (uint8_t i = 0; i < number; i++)
+			out[i] = 0;
+		return (0);
+	}
+	// scale rounded up: range <= largest, so range * scale < 256 << 16,
+	// and the largest range gives 255
+	uint32_t scale = (((uint32_t)255 << 16) + largest - 1) / largest;
+	for (uint8_t i = 0; i < number; i++)
+		out[i] = (uint8_t)(((uint32_t)getRange(first + i) * scale) >> 16);
+	return (largest);
+}
+
+#endif // _NEUROSHIELDFEATURES_H
@@ -0,0 +1,141 @@
+/*
+ * NeuroShieldKnowledge.cpp - Codec of the compact knowledge files
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NeuroShieldKnowledge.h>
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// ------------------------------------------------------------
+// CRC-16/CCITT, bitwise to keep the flash footprint small
+// ------------------------------------------------------------
+uint16_t knCrc16(uint16_t crc, const uint8_t* data, uint16_t size)
+{
+	for (uint16_t i = 0; i < size; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+	}
+	return (crc);
+}
+
+// ------------------------------------------------------------
+// Delta of the component i and number of equal deltas from i, up to max
+// ------------------------------------------------------------
+static uint8_t knDelta(const uint8_t comps[], uint16_t i)
+{
+	return ((i > 0) ? (uint8_t)(comps[i] - comps[i - 1]) : comps[0]);
+}
+
+static uint16_t knRun(const uint8_t comps[], uint16_t i, uint16_t length, uint16_t max)
+{
+	uint16_t run = 1;
+	uint8_t delta = knDelta(comps, i);
+	while ((i + run < length) && (run < max) && (knDelta(comps, i + run) == delta))
+		run++;
+	return (run);
+}
+
+// ------------------------------------------------------------
+// PackBits: a header byte n followed by n + 1 literal bytes (n < 128),
+// or by one byte repeated 257 - n times (n > 128)
+// Runs of 3 deltas or more are coded as runs, the rest as literals.
+// ------------------------------------------------------------
+void knEncodeComps(const uint8_t comps[], uint16_t length, uint16_t flags, KnPutByte put, void* ctx)
+{
+	uint16_t i = 0;
+
+	if (!(flags & KN_FLAG_RLE)) {
+		for (i = 0; i < length; i++)
+			put(ctx, comps[i]);
+		return;
+	}
+
+	while (i < length) {
+		uint16_t run = knRun(comps, i, length, 128);
+		if (run >= 3) {
+			put(ctx, (uint8_t)(257 - run));
+			put(ctx, knDelta(comps, i));
+			i += run;
+			continue;
+		}
+		uint16_t lit = 1;
+		while ((i + lit < length) && (lit < 128) && (knRun(comps, i + lit, length, 3) < 3))
+			lit++;
+		put(ctx, (uint8_t)(lit - 1));
+		for (uint16_t j = i; j < i + lit; j++)
+			put(ctx, knDelta(comps, j));
+		i += lit;
+	}
+}
+
+// ------------------------------------------------------------
+//    Constructor to the class KnCompDecoder
+// ------------------------------------------------------------
+KnCompDecoder::KnCompDecoder(uint16_t flags, KnGetByte get, void* ctx) :
+	flags(flags), get(get), ctx(ctx)
+{
+	reset();
+}
+
+void KnCompDecoder::reset()
+{
+	count = 0;
+	run = false;
+	value = 0;
+	prev = 0;
+}
+
+// ------------------------------------------------------------
+// Next component of the prototype
+// ------------------------------------------------------------
+uint8_t KnCompDecoder::next()
+{
+	if (!(flags & KN_FLAG_RLE))
+		return (get(ctx));
+
+	while (count == 0) {
+		uint8_t n = get(ctx);
+		if (n < 128) {
+			count = n + 1;
+			run = false;
+		} else if (n > 128) {
+			count = 257 - n;
+			run = true;
+			value = get(ctx);
+		}
+	}
+	count--;
+	prev += run ? value : get(ctx);
+	return (prev);
+}
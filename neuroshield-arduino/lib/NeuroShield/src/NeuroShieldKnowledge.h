@@ -0,0 +1,104 @@
+/*
+ * NeuroShieldKnowledge.h - Codec of the compact knowledge files
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NEUROSHIELDKNOWLEDGE_H
+#define _NEUROSHIELDKNOWLEDGE_H
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// ------------------------------------------------------------
+// Compact knowledge file, all the words are little-endian
+// header (12 bytes)
+//   KN_FORMAT_COMPACT, version, length, ncount, flags, 0
+// ncount records
+//   NCR, length components, AIF, MINIF, CAT
+//   the components are 8-bit, or with KN_FLAG_RLE the difference of
+//   each component with the previous one (0 before the first),
+//   PackBits run-length encoded
+// trailer
+//   CRC-16/CCITT of the header and the records
+// ------------------------------------------------------------
+#define KN_FORMAT_COMPACT	0x4B43	// Magic Number, "CK" in the file
+#define KN_COMPACT_VERSION	1
+#define KN_COMPACT_HEADER	12		// size of the header in byte
+
+#define KN_FLAG_RLE			0x0001	// delta + PackBits coded components
+
+// ------------------------------------------------------------
+// Checkpoint file, appended by each checkpoint
+// header (12 bytes)
+//   KN_FORMAT_CHECKPOINT, version, length, flags, 0, CRC of the header
+// records
+//   first, count, table
+//   table * (AIF, CAT) of the neurons 1 to table, 0 if unchanged
+//   count compact neuron records, from neuron first
+//   CRC-16/CCITT of the record
+// ------------------------------------------------------------
+#define KN_FORMAT_CHECKPOINT	0x5043	// Magic Number, "CP" in the file
+#define KN_CHECKPOINT_VERSION	1
+#define KN_CHECKPOINT_HEADER	12		// size of the header in byte
+
+// CRC-16/CCITT (polynomial 0x1021), starts from KN_CRC_INIT
+#define KN_CRC_INIT			0xFFFF
+uint16_t knCrc16(uint16_t crc, const uint8_t* data, uint16_t size);
+
+// write the length components of a prototype through put, coded as
+// selected by the flags
+typedef void (*KnPutByte)(void* ctx, uint8_t data);
+void knEncodeComps(const uint8_t comps[], uint16_t length, uint16_t flags, KnPutByte put, void* ctx);
+
+// ------------------------------------------------------------
+// Decode the components of a prototype, pulling the bytes of the
+// file through get. reset() at the start of each prototype.
+// ------------------------------------------------------------
+typedef uint8_t (*KnGetByte)(void* ctx);
+
+class KnCompDecoder
+{
+	public:
+		KnCompDecoder(uint16_t flags, KnGetByte get, void* ctx);
+		void reset();
+		uint8_t next();
+		
+	private:
+		uint16_t flags;
+		KnGetByte get;
+		void* ctx;
+		uint8_t count;			// components left in the current run or literal
+		bool run;
+		uint8_t value;			// repeated delta of a run
+		uint8_t prev;			// previous component
+};
+
+#endif // _NEUROSHIELDKNOWLEDGE_H
@@ -0,0 +1,257 @@
+/*
+ * NeuroShieldKnowledgeReader.cpp - Memory-mapped knowledge files on the host
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <NeuroShieldKnowledgeReader.h>
+#include <NeuroShieldKnowledge.h>
+
+#if defined(KN_READER)
+
+#include <algorithm>
+
+extern "C" {
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+}
+
+#define KN_HEADER	8		// KN_FORMAT, length, ncount, 0
+
+// largest ncount accepted, the identifiers fit 16 bits and 0xFFFF
+// means no neuron
+#define KN_READER_MAX_NEURONS	0xFFFE
+
+KnReader::KnReader()
+{
+}
+
+KnReader::~KnReader()
+{
+	close();
+}
+
+// --------------------------------------------------------
+// Map a knowledge file and check its header
+// Return 0 if the file is ready, or as loadKnowledgeFromSDcard()
+// 2 file not found, 3 file not readable, 4 not a KN_FORMAT file,
+// 5 neuron size error, 6 too many neurons, 7 file truncated
+// --------------------------------------------------------
+int KnReader::open(const char* filename)
+{
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return ((errno == ENOENT) ? 2 : 3);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return (3);
+	}
+
+	// No room for the header
+	if (st.st_size < KN_HEADER) {
+		::close(fd);
+		return (4);
+	}
+
+	void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) {
+		return (3);
+	}
+	map = (const uint8_t*)addr;
+	map_size = (size_t)st.st_size;
+
+	uint16_t header[KN_HEADER / 2];
+	for (int i = 0; i < (KN_HEADER / 2); i++)
+		header[i] = (uint16_t)(map[i * 2] | (map[i * 2 + 1] << 8));
+
+	// Magic number not matched, or a coded file
+	int ret_val = 0;
+	if ((header[0] < KN_FORMAT) || (header[0] == KN_FORMAT_COMPACT) || (header[0] == KN_FORMAT_CHECKPOINT)) {
+		ret_val = 4;
+	// Neuron size error
+	} else if ((header[1] == 0) || (header[1] > NEURON_SIZE)) {
+		ret_val = 5;
+	// Too many neurons
+	} else if (header[2] > KN_READER_MAX_NEURONS) {
+		ret_val = 6;
+	// File truncated
+	} else if (map_size < KN_HEADER + (size_t)header[2] * (header[1] + 4) * sizeof(uint16_t)) {
+		ret_val = 7;
+	}
+	if (ret_val != 0) {
+		close();
+		return (ret_val);
+	}
+
+	neuron_length = header[1];
+	neuron_count = header[2];
+	return (0);
+}
+
+// --------------------------------------------------------
+// Unmap the file, the views and the indexes are no longer valid
+// --------------------------------------------------------
+void KnReader::close()
+{
+	if (map != nullptr)
+		munmap((void*)map, map_size);
+	map = nullptr;
+	map_size = 0;
+	neuron_length = 0;
+	neuron_count = 0;
+	by_category = Index();
+	by_context = Index();
+}
+
+bool KnReader::isOpen()
+{
+	return (map != nullptr);
+}
+
+uint16_t KnReader::length()
+{
+	return (neuron_length);
+}
+
+uint16_t KnReader::ncount()
+{
+	return (neuron_count);
+}
+
+// --------------------------------------------------------
+// View of the record of the neuron nid (1 to ncount()), or of an
+// empty record (all 0) if the file has no such neuron
+// --------------------------------------------------------
+KnReader::Neuron KnReader::neuron(uint16_t nid)
+{
+	static const uint8_t empty[(NEURON_SIZE + 4) * sizeof(uint16_t)] = { 0 };
+	if ((nid == 0) || (nid > neuron_count))
+		return (Neuron(empty, neuron_length));
+	size_t offset = KN_HEADER + (size_t)(nid - 1) * (neuron_length + 4) * sizeof(uint16_t);
+	return (Neuron(&map[offset], neuron_length));
+}
+
+// --------------------------------------------------------
+// The ncount() records one after the other, in the layout taken by
+// writeNeurons(). The words are little-endian, so the records can be
+// used as they are on little-endian hosts only.
+// Return nullptr if no file is open
+// --------------------------------------------------------
+const uint16_t* KnReader::records()
+{
+	if (map == nullptr)
+		return (nullptr);
+	return ((const uint16_t*)&map[KN_HEADER]);
+}
+
+// --------------------------------------------------------
+// Distinct categories (degenerated flag masked) or contexts of the
+// neurons, by increasing value. Return their number.
+// --------------------------------------------------------
+uint16_t KnReader::categories(const uint16_t** values)
+{
+	build(by_category, true);
+	*values = by_category.values.data();
+	return ((uint16_t)by_category.values.size());
+}
+
+uint16_t KnReader::contexts(const uint16_t** values)
+{
+	build(by_context, false);
+	*values = by_context.values.data();
+	return ((uint16_t)by_context.values.size());
+}
+
+// --------------------------------------------------------
+// Identifiers of the neurons of a category (degenerated or not) or a
+// context, by increasing identifier. Return their number.
+// --------------------------------------------------------
+uint16_t KnReader::categoryNeurons(uint16_t category, const uint16_t** nids)
+{
+	build(by_category, true);
+	return (find(by_category, category & 0x7FFF, nids));
+}
+
+uint16_t KnReader::contextNeurons(uint8_t context, const uint16_t** nids)
+{
+	build(by_context, false);
+	return (find(by_context, context & 0x007F, nids));
+}
+
+// --------------------------------------------------------
+// Sort the neurons by category or context, then identifier
+// --------------------------------------------------------
+void KnReader::build(Index& index, bool category)
+{
+	if (index.built)
+		return;
+	index.built = true;
+
+	std::vector<uint32_t> keys(neuron_count);
+	for (uint32_t nid = 1; nid <= neuron_count; nid++) {
+		Neuron n = neuron((uint16_t)nid);
+		uint16_t value = category ? (n.cat() & 0x7FFF) : n.context();
+		keys[nid - 1] = ((uint32_t)value << 16) | nid;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	index.nids.resize(neuron_count);
+	for (uint32_t i = 0; i < neuron_count; i++) {
+		uint16_t value = (uint16_t)(keys[i] >> 16);
+		if (index.values.empty() || (index.values.back() != value)) {
+			index.values.push_back(value);
+			index.first.push_back(i);
+		}
+		index.nids[i] = (uint16_t)keys[i];
+	}
+	index.first.push_back(neuron_count);
+}
+
+uint16_t KnReader::find(Index& index, uint16_t value, const uint16_t** nids)
+{
+	std::vector<uint16_t>::iterator it = std::lower_bound(index.values.begin(), index.values.end(), value);
+	if ((it == index.values.end()) || (*it != value)) {
+		*nids = nullptr;
+		return (0);
+	}
+	size_t i = it - index.values.begin();
+	*nids = &index.nids[index.first[i]];
+	return ((uint16_t)(index.first[i + 1] - index.first[i]));
+}
+
+#endif // KN_READER
@@ -0,0 +1,138 @@
+/*
+ * NeuroShieldKnowledgeReader.h - Memory-mapped knowledge files on the host
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NEUROSHIELDKNOWLEDGEREADER_H
+#define _NEUROSHIELDKNOWLEDGEREADER_H
+
+#include <NeuroShield.h>
+
+// memory-mapped files, on POSIX hosts
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+#define KN_READER
+
+#include <vector>
+
+extern "C" {
+  #include <stdint.h>
+  #include <stddef.h>
+}
+
+// ------------------------------------------------------------
+// KnReader
+// Read-only access to a knowledge file of saveKnowledgeToSDcard()
+// (KN_FORMAT), mapped in memory. The header is checked by open(), the
+// neuron records are then used in place, without parsing nor copy:
+//
+//   KnReader kn;
+//   if (kn.open("model.knf") == 0) {
+//       const uint16_t* nids;
+//       uint16_t count = kn.categoryNeurons(3, &nids);
+//       for (uint16_t i = 0; i < count; i++)
+//           use(kn.neuron(nids[i]).aif());
+//   }
+//
+// The per-category and per-context indexes are built at their first
+// use. A reader is used by one thread at a time.
+// The compact and checkpoint files are coded and must be loaded with
+// loadKnowledgeFromSDcard().
+// ------------------------------------------------------------
+class KnReader
+{
+	public:
+		// view of a neuron record of the file: NCR, length * COMP, AIF, MINIF, CAT
+		class Neuron
+		{
+			public:
+				Neuron(const uint8_t* record, uint16_t length) : record(record), len(length) {}
+				
+				uint16_t length() const { return (len); }
+				uint16_t ncr() const { return (word(0)); }
+				uint8_t context() const { return ((uint8_t)(word(0) & 0x007F)); }
+				uint8_t comp(uint16_t index) const { return ((uint8_t)word(index + 1)); }
+				uint16_t aif() const { return (word(len + 1)); }
+				uint16_t minif() const { return (word(len + 2)); }
+				uint16_t cat() const { return (word(len + 3)); }
+				
+			private:
+				const uint8_t* record;
+				uint16_t len;
+				
+				// the words of the file are little-endian
+				uint16_t word(uint16_t index) const {
+					return ((uint16_t)(record[index * 2] | (record[index * 2 + 1] << 8)));
+				}
+		};
+		
+		KnReader();
+		~KnReader();
+		
+		int open(const char* filename);
+		void close();
+		bool isOpen();
+		
+		uint16_t length();
+		uint16_t ncount();
+		Neuron neuron(uint16_t nid);
+		const uint16_t* records();
+		
+		uint16_t categories(const uint16_t** values);
+		uint16_t categoryNeurons(uint16_t category, const uint16_t** nids);
+		uint16_t contexts(const uint16_t** values);
+		uint16_t contextNeurons(uint8_t context, const uint16_t** nids);
+		
+	private:
+		KnReader(const KnReader&);
+		KnReader& operator=(const KnReader&);
+		
+		// neurons grouped by a value of their record, by increasing
+		// value then identifier
+		struct Index {
+			bool built = false;
+			std::vector<uint16_t> values;	// distinct values
+			std::vector<uint32_t> first;	// position in nids of the neurons of each value, and the end
+			std::vector<uint16_t> nids;
+		};
+		
+		const uint8_t* map = nullptr;
+		size_t map_size = 0;
+		uint16_t neuron_length = 0;
+		uint16_t neuron_count = 0;
+		Index by_category;
+		Index by_context;
+		
+		void build(Index& index, bool category);
+		uint16_t find(Index& index, uint16_t value, const uint16_t** nids);
+};
+
+#endif // KN_READER
+
+#endif // _NEUROSHIELDKNOWLEDGEREADER_H
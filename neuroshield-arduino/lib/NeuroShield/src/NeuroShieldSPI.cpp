@@ -42,31 +42,80 @@
 
 #include <NeuroShield.h>
 #include <NeuroShieldSPI.h>
+#if defined(NM500_EMULATOR)
+#include <NM500Emulator.h>
+#else
 #include <SPI.h>
+#endif
 
 extern "C" {
   #include <stdint.h>
+  #include <string.h>
 }
 
+#if defined(NM500_EMULATOR)
+static void delay(unsigned long) {	// the emulator is always ready
+}
+#endif
+
+#if NEUROSHIELD_STATS && defined(NM500_EMULATOR)
+#include <time.h>
+static uint32_t micros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint32_t)ts.tv_sec * 1000000UL + (uint32_t)(ts.tv_nsec / 1000));
+}
+#endif
+
 // ----------------------------------------------------------------
 //    Constructor to the class ShieldSPI.
 // ----------------------------------------------------------------
 NeuroShieldSPI::NeuroShieldSPI(){	
+#if NEUROSHIELD_STATS
+	resetStats();
+#endif
+}
+
+#if defined(NM500_EMULATOR)
+NeuroShieldSPI::~NeuroShieldSPI()
+{
+	if (own_emulator)
+		delete emulator;
+}
+
+// ----------------------------------------------------------------
+// Serve the frames with the given emulator instead of the one
+// created by connect()
+// ----------------------------------------------------------------
+void NeuroShieldSPI::attach(NM500Emulator* nm500)
+{
+	if (own_emulator)
+		delete emulator;
+	emulator = nm500;
+	own_emulator = false;
 }
+#endif
 
 // ----------------------------------------------------------------
 // Initialize the SPI communication and verify proper interface
 // to the NM500 by reading the default Minif value of 2-bytes
+// With poll, the NM500 is probed every millisecond after the reset
+// instead of waiting the worst-case delays
 // return an error:0 otherwise=1
 // ----------------------------------------------------------------
-bool NeuroShieldSPI::connect(uint8_t slave_select)
+bool NeuroShieldSPI::connect(uint8_t slave_select, bool poll)
 {
 	uint16_t read_value;
 	
 	shield_ss = slave_select;
 	
+#if defined(NM500_EMULATOR)
+	if (emulator == nullptr) {
+		emulator = new NM500Emulator();
+		own_emulator = true;
+	}
+#else
 	SPI.begin();
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);		// spi clock : 16MHz / 8 = 2MHz
 	
 	pinMode(shield_ss, OUTPUT);
 	digitalWrite(shield_ss, HIGH);
@@ -76,10 +125,20 @@ bool NeuroShieldSPI::connect(uint8_t slave_select)
 	
 	pinMode(ARDUINO_SD_CS, OUTPUT);				// ARDUINO_SD_CS must be HIGH
 	digitalWrite(ARDUINO_SD_CS, HIGH);
+#endif
 	
 	// return 1 if NM500 present and SPI comm successful
 	for (int i = 0; i < 10; i++) {
 		reset();	// NM500 reset
+		if (poll) {
+			for (int t = 0; t < NM500_READY_TIMEOUT; t++) {
+				delay(1);
+				write(NM_FORGET, 0);
+				if (read(NM_MINIF) == 2)
+					return(1);
+			}
+			continue;
+		}
 		delay(100);
 		write(NM_FORGET, 0);
 		delay(50);
@@ -93,44 +152,194 @@ bool NeuroShieldSPI::connect(uint8_t slave_select)
 }
 
 // ----------------------------------------------------------------
-// SPI Read the register of a given module (module + reg = addr)
+// SPI clock of this shield in Hz (2MHz by default), applied at the
+// start of each frame
 // ----------------------------------------------------------------
-uint16_t NeuroShieldSPI::read(uint8_t reg)
+void NeuroShieldSPI::setClock(uint32_t clock)
+{
+	applyClock(clock);
+}
+
+uint32_t NeuroShieldSPI::getClock()
+{
+	return(spi_clock);
+}
+
+// the settings passed to each transaction are built here, once per
+// change of clock rather than once per frame
+void NeuroShieldSPI::applyClock(uint32_t clock)
+{
+	spi_clock = clock;
+#if !defined(NM500_EMULATOR)
+	spi_settings = SPISettings(clock, MSBFIRST, SPI_MODE0);
+#endif
+}
+
+// ----------------------------------------------------------------
+// Find the fastest reliable clock up to max_clock, doubling the
+// default clock while MINIF patterns written at that rate read back
+// unchanged, and keep it. A failed rate may corrupt the NM500 state,
+// so the probe ends with a FORGET and is meant for connect time only.
+// return the selected clock
+// ----------------------------------------------------------------
+uint32_t NeuroShieldSPI::probeClock(uint32_t max_clock)
+{
+	static const uint16_t patterns[4] = { 0x5AA5, 0xA55A, 0x00FF, 0xFF00 };
+	uint32_t good = NM500_SPI_CLK;
+	
+	for (uint32_t clock = NM500_SPI_CLK * 2; clock <= max_clock; clock *= 2) {
+		bool pass = true;
+		applyClock(clock);
+		for (uint8_t i = 0; (i < 4) && pass; i++) {
+			write(NM_MINIF, patterns[i]);
+			pass = (read(NM_MINIF) == patterns[i]);
+		}
+		if (!pass)
+			break;
+		good = clock;
+	}
+	applyClock(good);
+	write(NM_FORGET, 0);
+	return(spi_clock);
+}
+
+// ----------------------------------------------------------------
+// Frame helpers
+// A frame is an 8-byte header (dummy ID, 4-byte address with the
+// module and write flag in addr[24:31], 3-byte word count) followed
+// by 2 bytes per word. The header and the payload are assembled in
+// the frame buffer and pushed on the bus in as few buffered
+// transfers as the buffer size allows, while SS stays low.
+// ----------------------------------------------------------------
+void NeuroShieldSPI::select()
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
+#if defined(NM500_EMULATOR)
+	emulator->select();
+#else
+	SPI.beginTransaction(spi_settings);
 	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);							// Dummy for ID
-	SPI.transfer((uint8_t)module_nm500);		// address (4-byte)
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(reg);
-	SPI.transfer(0);							// word size (3-byte)
-	SPI.transfer(0);
-	SPI.transfer(1);							// expect 1 word back
-	uint16_t data = SPI.transfer(0);			// Send 0 to push upper data out
-	data = (data << 8) + SPI.transfer(0);		// Send 0 to push lower data out
+#endif
+}
+
+void NeuroShieldSPI::deselect()
+{
+#if defined(NM500_EMULATOR)
+	emulator->deselect();
+#else
 	digitalWrite(shield_ss, HIGH);
-	return(data);
+	SPI.endTransaction();
+#endif
+}
+
+uint16_t NeuroShieldSPI::header(uint8_t module, uint8_t reg, uint16_t size)
+{
+	frame[0] = 1;										// Dummy for ID
+	frame[1] = module;									// address (4-byte)
+	frame[2] = 0;
+	frame[3] = 0;
+	frame[4] = reg;
+	frame[5] = 0;										// word size (3-byte)
+	frame[6] = (uint8_t)((size >> 8) & 0x00FF);
+	frame[7] = (uint8_t)(size & 0x00FF);
+#if NEUROSHIELD_STATS
+	stats.frames++;
+	if (size > 1)
+		stats.burst_frames++;
+	else
+		stats.single_frames++;
+	if (((module & 0x7F) == module_nm500) && (reg < 16)) {
+		if (module & 0x80)
+			stats.writes[reg]++;
+		else
+			stats.reads[reg]++;
+	}
+#endif
+	return(8);
+}
+
+void NeuroShieldSPI::flush(uint16_t length)
+{
+#if NEUROSHIELD_STATS
+	uint32_t start = micros();
+	NM500_SPI_TRANSFER(frame, length);
+	stats.transfer_us += micros() - start;
+	stats.bytes += length;
+#else
+	NM500_SPI_TRANSFER(frame, length);
+#endif
+}
+
+// ----------------------------------------------------------------
+// SPI Read the register of a given module (module + reg = addr)
+// ----------------------------------------------------------------
+uint16_t NeuroShieldSPI::read(uint8_t reg)
+{
+	select();
+	uint16_t len = header(module_nm500, reg, 1);	// expect 1 word back
+	frame[len++] = 0;								// Send 0 to push upper data out
+	frame[len++] = 0;								// Send 0 to push lower data out
+	flush(len);
+	deselect();
+	return((uint16_t)((frame[8] << 8) | frame[9]));
 }
 
 void NeuroShieldSPI::readVector16(uint16_t* data, uint16_t size)
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);								// Dummy for ID
-	SPI.transfer((uint8_t)module_nm500);			// address (4-byte)
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(NM_COMP);
-	SPI.transfer(0);								// word size (3-byte)
-	SPI.transfer((uint8_t)((size >> 8) & 0x00FF));
-	SPI.transfer((uint8_t)(size & 0x00FF));
-	for (int i = 0; i < size; i++) {
-		*data = SPI.transfer(0);					// Send 0 to push upper data out
-		*data = (*data << 8) + SPI.transfer(0);		// Send 0 to push lower data out
-		data++;
+	readBurst(NM_COMP, data, size);
+}
+
+// ----------------------------------------------------------------
+// Same as above with one byte per component, the upper data of
+// COMP is always 0
+// ----------------------------------------------------------------
+void NeuroShieldSPI::readVector(uint8_t* data, uint16_t size)
+{
+	select();
+	uint16_t len = header(module_nm500, NM_COMP, size);
+	if (size == 0)
+		flush(len);
+	while (size > 0) {
+		uint16_t words = (NM500_SPI_FRAME_SIZE - len) >> 1;
+		if (words > size)
+			words = size;
+		memset(&frame[len], 0, (words << 1));			// Send 0 to push data out
+		flush(len + (words << 1));
+		for (uint16_t i = 0; i < words; i++) {
+			*data = frame[len + 1];
+			len += 2;
+			data++;
+		}
+		size -= words;
+		len = 0;
 	}
-	digitalWrite(shield_ss, HIGH);
+	deselect();
+}
+
+// ----------------------------------------------------------------
+// SPI Read size words of a register in a single frame (burst-mode)
+// Needs an FPGA with burst-read support
+// ----------------------------------------------------------------
+void NeuroShieldSPI::readBurst(uint8_t reg, uint16_t* data, uint16_t size)
+{
+	select();
+	uint16_t len = header(module_nm500, reg, size);
+	if (size == 0)
+		flush(len);
+	while (size > 0) {
+		uint16_t words = (NM500_SPI_FRAME_SIZE - len) >> 1;
+		if (words > size)
+			words = size;
+		memset(&frame[len], 0, (words << 1));			// Send 0 to push data out
+		flush(len + (words << 1));
+		for (uint16_t i = 0; i < words; i++) {
+			*data = (uint16_t)((frame[len] << 8) | frame[len + 1]);
+			len += 2;
+			data++;
+		}
+		size -= words;
+		len = 0;
+	}
+	deselect();
 }
 
 // ----------------------------------------------------------------
@@ -138,75 +347,183 @@ void NeuroShieldSPI::readVector16(uint16_t* data, uint16_t size)
 // ----------------------------------------------------------------
 void NeuroShieldSPI::write(uint8_t reg, uint16_t data)
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);									// Dummy for ID
-	SPI.transfer((uint8_t)(module_nm500 + 0x80));		// module and write flag
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(reg);
-	SPI.transfer(0);									// word size (3-byte)
-	SPI.transfer(0);
-	SPI.transfer(1);									// expect 1 word back
-	if ((reg == NM_COMP) || (reg == NM_LCOMP)) {
-		SPI.transfer(0x00);								// upper data
-		SPI.transfer((uint8_t)(data & 0x00FF));			// lower data
+	select();
+	uint16_t len = header((uint8_t)(module_nm500 + 0x80), reg, 1);	// module and write flag
+	if ((reg == NM_COMP) || (reg == NM_LCOMP))
+		frame[len++] = 0x00;										// upper data
+	else
+		frame[len++] = (uint8_t)((data >> 8) & 0x00FF);				// upper data
+	frame[len++] = (uint8_t)(data & 0x00FF);						// lower data
+	flush(len);
+	if ((reg == NM_COMP) || (reg == NM_LCOMP) || (reg == NM_TESTCOMP))
+		touchComps();
+	deselect();
+	track(reg, data);
+}
+
+// ----------------------------------------------------------------
+// Register shadow
+// The values written to GCR, NSR, MINIF and MAXIF are kept so that a
+// read-modify-write of these registers costs a single frame. The
+// shadow is invalidated by FORGET and by the reset, and a register is
+// read over SPI the first time it is needed.
+// In SR-mode MINIF and MAXIF address the neuron pointed by the chain,
+// so writing them forgets their global value.
+// ----------------------------------------------------------------
+int8_t NeuroShieldSPI::shadowIndex(uint8_t reg)
+{
+	switch (reg) {
+		case NM_GCR:	return(0);
+		case NM_NSR:	return(1);
+		case NM_MINIF:	return(2);
+		case NM_MAXIF:	return(3);
+		default:		return(-1);
+	}
+}
+
+bool NeuroShieldSPI::normalMode()
+{
+	int8_t nsr = shadowIndex(NM_NSR);
+	return((shadow_valid & (1 << nsr)) && !(shadow[nsr] & 0x0010));
+}
+
+void NeuroShieldSPI::track(uint8_t reg, uint16_t data)
+{
+	if (reg == NM_FORGET) {									// GCR, MINIF, MAXIF back to default
+		shadow_valid &= (1 << shadowIndex(NM_NSR));
+		return;
 	}
-	else {
-		SPI.transfer((uint8_t)((data >> 8) & 0x00FF));	// upper data
-		SPI.transfer((uint8_t)(data & 0x00FF));			// lower data
+	int8_t i = shadowIndex(reg);
+	if (i < 0)
+		return;
+	if (((reg == NM_MINIF) || (reg == NM_MAXIF)) && !normalMode()) {
+		shadow_valid &= ~(1 << i);
+		return;
+	}
+	if (reg == NM_NSR)
+		data &= ~0x000C;									// UNC and ID are read-only
+	shadow[i] = data;
+	shadow_valid |= (1 << i);
+}
+
+// ----------------------------------------------------------------
+// Value of a shadowed register, read over SPI if unknown
+// NSR is returned without its UNC and ID status bits
+// ----------------------------------------------------------------
+uint16_t NeuroShieldSPI::readShadow(uint8_t reg)
+{
+	int8_t i = shadowIndex(reg);
+	if (i < 0)
+		return(read(reg));
+	if (((reg == NM_MINIF) || (reg == NM_MAXIF)) && (readShadow(NM_NSR) & 0x0010))
+		return(read(reg));
+	if (!(shadow_valid & (1 << i))) {
+		shadow[i] = read(reg);
+		if (reg == NM_NSR)
+			shadow[i] &= ~0x000C;
+		shadow_valid |= (1 << i);
+	}
+	return(shadow[i]);
+}
+
+// ----------------------------------------------------------------
+// Write a register unless the shadow shows it already holds the value
+// ----------------------------------------------------------------
+void NeuroShieldSPI::update(uint8_t reg, uint16_t data)
+{
+	int8_t i = shadowIndex(reg);
+	bool known = (i >= 0) && (shadow_valid & (1 << i));
+	if (known && ((reg == NM_MINIF) || (reg == NM_MAXIF)))
+		known = normalMode();
+	if (known && (shadow[i] == data))
+		return;
+	write(reg, data);
+}
+
+void NeuroShieldSPI::invalidateShadow()
+{
+	shadow_valid = 0;
+}
+
+// ----------------------------------------------------------------
+// Components of the neurons known to be all 0
+// markCompsClear() is called once they were cleared, any component
+// written afterwards makes compsClear() false again.
+// ----------------------------------------------------------------
+bool NeuroShieldSPI::compsClear()
+{
+	return(comps_clear);
+}
+
+void NeuroShieldSPI::markCompsClear()
+{
+	comps_clear = true;
+}
+
+void NeuroShieldSPI::touchComps()
+{
+	comps_clear = false;
+}
+
+// ----------------------------------------------------------------
+// Read the shadowed registers again, after the NM500 was changed
+// behind the driver
+// ----------------------------------------------------------------
+void NeuroShieldSPI::resyncShadow()
+{
+	shadow_valid = 0;
+	readShadow(NM_NSR);
+	readShadow(NM_GCR);
+	if (normalMode()) {
+		readShadow(NM_MINIF);
+		readShadow(NM_MAXIF);
 	}
-	digitalWrite(shield_ss, HIGH);
 }
 
 // ----------------------------------------------------------------
 // SPI Write burst mode at COMP register
 // ----------------------------------------------------------------
-uint16_t NeuroShieldSPI::writeVector(uint8_t* data, uint16_t size)
+uint16_t NeuroShieldSPI::writeVector(const uint8_t* data, uint16_t size)
 {
 	if (size > NEURON_SIZE)							// to use SR-mode
 		return(0);
 	
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);								// Dummy for ID
-	SPI.transfer((uint8_t)(module_nm500 + 0x80));	// module and write flag
-	SPI.transfer(0);								
-	SPI.transfer(0);
-	SPI.transfer(NM_COMP);
-	SPI.transfer(0);								// word size (3-byte)
-	SPI.transfer((uint8_t)((size >> 8) & 0x00FF));
-	SPI.transfer((uint8_t)(size & 0x00FF));
-	for (int i = 0; i < size; i++) {
-		SPI.transfer(0x00);							// COMP' upper data = 0x00
-		SPI.transfer((uint8_t)(*data));				// lower data
+	select();
+	uint16_t len = header((uint8_t)(module_nm500 + 0x80), NM_COMP, size);
+	for (uint16_t i = 0; i < size; i++) {
+		if (len == NM500_SPI_FRAME_SIZE) {
+			flush(len);
+			len = 0;
+		}
+		frame[len++] = 0x00;						// COMP' upper data = 0x00
+		frame[len++] = *data;						// lower data
 		data++;
 	}
-	digitalWrite(shield_ss, HIGH);
+	flush(len);
+	touchComps();
+	deselect();
 	return(size);
 }
 
-uint16_t NeuroShieldSPI::writeVector16(uint16_t* data, uint16_t size)
+uint16_t NeuroShieldSPI::writeVector16(const uint16_t* data, uint16_t size)
 {
 	if (size > NEURON_SIZE)							// to use SR-mode
 		return(0);
 
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);								// Dummy for ID
-	SPI.transfer((uint8_t)(module_nm500 + 0x80));	// module and write flag
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(NM_COMP);
-	SPI.transfer(0);								// word size (3-byte)
-	SPI.transfer((uint8_t)((size >> 8) & 0x00FF));
-	SPI.transfer((uint8_t)(size & 0x00FF));
-	for (int i = 0; i < size; i++) {
-		SPI.transfer(0x00);							// COMP' upper data = 0x00
-		SPI.transfer((uint8_t)((*data) & 0x00FF));	// lower data
+	select();
+	uint16_t len = header((uint8_t)(module_nm500 + 0x80), NM_COMP, size);
+	for (uint16_t i = 0; i < size; i++) {
+		if (len == NM500_SPI_FRAME_SIZE) {
+			flush(len);
+			len = 0;
+		}
+		frame[len++] = 0x00;						// COMP' upper data = 0x00
+		frame[len++] = (uint8_t)((*data) & 0x00FF);	// lower data
 		data++;
 	}
-	digitalWrite(shield_ss, HIGH);
+	flush(len);
+	touchComps();
+	deselect();
 	return(size);
 }
 
@@ -215,20 +532,13 @@ uint16_t NeuroShieldSPI::writeVector16(uint16_t* data, uint16_t size)
 // ----------------------------------------------------------------
 uint16_t NeuroShieldSPI::version()
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);						// Dummy for ID
-	SPI.transfer((uint8_t)module_fpga);		// address (4-byte)
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(1);						// version check : 0x01
-	SPI.transfer(0);						// word size (3-byte)
-	SPI.transfer(0);
-	SPI.transfer(1);						// expect 1 word back
-	uint16_t data = SPI.transfer(0);		// Send 0 to push upper data out
-	data = (data << 8) + SPI.transfer(0);	// Send 0 to push lower data out
-	digitalWrite(shield_ss, HIGH);
-	return(data);
+	select();
+	uint16_t len = header(module_fpga, 1, 1);		// version check : 0x01
+	frame[len++] = 0;
+	frame[len++] = 0;
+	flush(len);
+	deselect();
+	return((uint16_t)((frame[8] << 8) | frame[9]));
 }
 
 // ----------------------------------------------------------------
@@ -236,19 +546,14 @@ uint16_t NeuroShieldSPI::version()
 // ----------------------------------------------------------------
 void NeuroShieldSPI::reset()
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);									// Dummy for ID
-	SPI.transfer((uint8_t)(module_fpga + 0x80));		// address (4-byte)
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(2);									// nm500 sw reset : 0x02
-	SPI.transfer(0);									// word size (3-byte)
-	SPI.transfer(0);
-	SPI.transfer(1);									// expect 1 word back
-	SPI.transfer(0);
-	SPI.transfer(0);
-	digitalWrite(shield_ss, HIGH);
+	invalidateShadow();
+	comps_clear = false;
+	select();
+	uint16_t len = header((uint8_t)(module_fpga + 0x80), 2, 1);	// nm500 sw reset : 0x02
+	frame[len++] = 0;
+	frame[len++] = 0;
+	flush(len);
+	deselect();
 }
 
 // ----------------------------------------------------------------
@@ -256,17 +561,25 @@ void NeuroShieldSPI::reset()
 // ----------------------------------------------------------------
 void NeuroShieldSPI::ledSelect(uint8_t data)
 {
-	SPI.setClockDivider(NM500_SPI_CLK_DIV);
-	digitalWrite(shield_ss, LOW);
-	SPI.transfer(1);									// Dummy for ID
-	SPI.transfer((uint8_t)(module_led + 0x80));			// address (4-byte)
-	SPI.transfer(0);
-	SPI.transfer(0);
-	SPI.transfer(data);									// led scenario select
-	SPI.transfer(0);									// word size (3-byte)
-	SPI.transfer(0);
-	SPI.transfer(1);									// expect 1 word back
-	SPI.transfer(0);
-	SPI.transfer(0);
-	digitalWrite(shield_ss, HIGH);
+	select();
+	uint16_t len = header((uint8_t)(module_led + 0x80), data, 1);	// led scenario select
+	frame[len++] = 0;
+	frame[len++] = 0;
+	flush(len);
+	deselect();
+}
+
+#if NEUROSHIELD_STATS
+// ----------------------------------------------------------------
+// Snapshot of the bus counters, and their reset
+// ----------------------------------------------------------------
+void NeuroShieldSPI::getStats(Stats* out)
+{
+	memcpy(out, &stats, sizeof(Stats));
+}
+
+void NeuroShieldSPI::resetStats()
+{
+	memset(&stats, 0, sizeof(Stats));
 }
+#endif
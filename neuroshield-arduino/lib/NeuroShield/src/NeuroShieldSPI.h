@@ -44,33 +44,148 @@
 #define _NEUROSHIELDSPI_H
 
 #define NM500_SPI_CLK_DIV	SPI_CLOCK_DIV8	// spi clock : 16MHz / 8 = 2MHz.
-#define NM500_SPI_CLK		2000000
+#define NM500_SPI_CLK		2000000			// default spi clock of a NeuroShieldSPI
+
+// fastest spi clock tried by probeClock()
+#ifndef NM500_SPI_CLK_MAX
+#if defined(__AVR__)
+#define NM500_SPI_CLK_MAX	(F_CPU / 2)
+#else
+#define NM500_SPI_CLK_MAX	16000000
+#endif
+#endif
+
+// longest wait in ms for the NM500 to answer after a reset, when polled
+#ifndef NM500_READY_TIMEOUT
+#define NM500_READY_TIMEOUT	150
+#endif
+
+// without the Arduino core, the frames are served by a software NM500
+#if !defined(ARDUINO) && !defined(NM500_EMULATOR)
+#define NM500_EMULATOR
+#endif
+
+// size of the frame buffer in byte, must be even and hold at least the
+// 8-byte header and one word. Longer bursts are sent in several chunks
+// without releasing the slave select.
+#ifndef NM500_SPI_FRAME_SIZE
+#define NM500_SPI_FRAME_SIZE	64
+#endif
+#if (NM500_SPI_FRAME_SIZE < 10) || (NM500_SPI_FRAME_SIZE & 1)
+#error "NM500_SPI_FRAME_SIZE must be even and at least 10"
+#endif
+
+// buffered transfer of a frame chunk, received bytes replace the sent ones.
+// Define it before including the library to plug a DMA-backed transfer.
+#ifndef NM500_SPI_TRANSFER
+#if defined(NM500_EMULATOR)
+#define NM500_SPI_TRANSFER(buf, len)	emulator->transfer((buf), (len))
+#elif defined(ARDUINO_ARCH_ESP32)
+#define NM500_SPI_TRANSFER(buf, len)	SPI.transferBytes((buf), (buf), (len))
+#else
+#define NM500_SPI_TRANSFER(buf, len)	SPI.transfer((buf), (len))
+#endif
+#endif
+
+// counters of the frames and of the recognitions, see getStats()
+#ifndef NEUROSHIELD_STATS
+#define NEUROSHIELD_STATS	0
+#endif
 
 extern "C" {
   #include <stdint.h>
 }
 
+#if defined(NM500_EMULATOR)
+class NM500Emulator;
+#else
+#include <SPI.h>
+#endif
+
 class NeuroShieldSPI
 {
 	public:				
 			
 		NeuroShieldSPI();
+#if defined(NM500_EMULATOR)
+		~NeuroShieldSPI();
+		void attach(NM500Emulator* nm500);
+		NM500Emulator* emulator = nullptr;
+#endif
 		uint8_t shield_ss;
-		bool connect(uint8_t slave_select);
+		bool connect(uint8_t slave_select, bool poll = false);
+		
+		void setClock(uint32_t clock);
+		uint32_t getClock();
+		uint32_t probeClock(uint32_t max_clock);
 		
 		uint16_t read(uint8_t reg);
+		void readVector(uint8_t* data, uint16_t size);
 		void readVector16(uint16_t* data, uint16_t size);
+		void readBurst(uint8_t reg, uint16_t* data, uint16_t size);
 		void write(uint8_t reg, uint16_t data);
-		uint16_t writeVector(uint8_t* data, uint16_t size);
-		uint16_t writeVector16(uint16_t* data, uint16_t size);
+		uint16_t writeVector(const uint8_t* data, uint16_t size);
+		uint16_t writeVector16(const uint16_t* data, uint16_t size);
+		
+		uint16_t readShadow(uint8_t reg);
+		void update(uint8_t reg, uint16_t data);
+		void invalidateShadow();
+		void resyncShadow();
+		
+		bool compsClear();
+		void markCompsClear();
 		
 		uint16_t version();
 		void reset();
 		void ledSelect(uint8_t data);
 		
+#if NEUROSHIELD_STATS
+		// bus activity since the last resetStats()
+		struct Stats {
+			uint32_t frames;
+			uint32_t bytes;
+			uint32_t single_frames;			// frames of one word
+			uint32_t burst_frames;			// frames of several words
+			uint32_t transfer_us;			// time spent in the buffered transfers
+			uint32_t reads[16];				// NM500 read frames per register
+			uint32_t writes[16];			// NM500 write frames per register
+		};
+		void getStats(Stats* out);
+		void resetStats();
+#endif
+		
 		static const uint8_t module_nm500 = 0x01;		// addr[24:31] to access NM500 chip
 		static const uint8_t module_fpga  = 0x02;
 		static const uint8_t module_led   = 0x03;
+		
+	private:
+		uint8_t frame[NM500_SPI_FRAME_SIZE];
+		uint32_t spi_clock = NM500_SPI_CLK;
+#if !defined(NM500_EMULATOR)
+		SPISettings spi_settings = SPISettings(NM500_SPI_CLK, MSBFIRST, SPI_MODE0);
+#endif
+		void applyClock(uint32_t clock);
+		
+		// last value written to GCR, NSR (mode bits), MINIF and MAXIF
+		uint16_t shadow[4];
+		uint8_t shadow_valid = 0;			// one bit per shadowed register
+		static int8_t shadowIndex(uint8_t reg);
+		
+		bool comps_clear = false;			// no component written since markCompsClear()
+		void touchComps();
+		void track(uint8_t reg, uint16_t data);
+		bool normalMode();
+#if defined(NM500_EMULATOR)
+		bool own_emulator = false;
+#endif
+#if NEUROSHIELD_STATS
+		Stats stats;
+#endif
+		
+		void select();
+		void deselect();
+		uint16_t header(uint8_t module, uint8_t reg, uint16_t size);
+		void flush(uint16_t length);
 };
 
 #endif // _NEUROSHIELDSPI_H
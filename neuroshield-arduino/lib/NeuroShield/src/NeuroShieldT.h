@@ -0,0 +1,156 @@
+/*
+ * NeuroShieldT.h - NeuroShield front end for a fixed vector length
+ * Copyright (c) 2017, nepes inc, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NEUROSHIELDT_H
+#define _NEUROSHIELDT_H
+
+#include <NeuroShield.h>
+
+extern "C" {
+	#include <stdint.h>
+}
+
+// ------------------------------------------------------------
+// NeuroShieldT<VectorLen>
+// NeuroShield for an application whose vectors always have VectorLen
+// components. The length is a compile-time constant of every call,
+// the vectors and the neuron records are fixed-size arrays, and the
+// neuron readout and the knowledge files only carry the VectorLen
+// components in use (VectorLen + 4 words per neuron instead of
+// NEURON_SIZE + 4).
+//
+//   NeuroShieldT<24> hnn;
+//   NeuroShieldT<24>::Vector vector;
+//   NeuroShieldT<24>::Record neuron;
+//   hnn.learn(vector, 1);
+//   hnn.readNeuron(1, neuron);
+//
+// The methods of NeuroShield with an explicit length remain available,
+// except the neuron readout and write of full NEURON_SIZE records,
+// hidden so that they are not called with a Record by mistake.
+// ------------------------------------------------------------
+template <uint16_t VectorLen>
+class NeuroShieldT : public NeuroShield
+{
+	static_assert((VectorLen > 0) && (VectorLen <= NEURON_SIZE), "VectorLen must be within 1..NEURON_SIZE");
+
+	public:
+		static const uint16_t vector_length = VectorLen;
+		static const uint16_t record_size = VectorLen + 4;		// words of a neuron record
+
+		typedef uint8_t Vector[VectorLen];
+		typedef uint16_t Record[VectorLen + 4];				// NCR, VectorLen * COMP, AIF, MINIF, CAT
+
+		using NeuroShield::broadcast;
+		using NeuroShield::learn;
+		using NeuroShield::learnBatch;
+		using NeuroShield::classify;
+		using NeuroShield::classifyBatch;
+		using NeuroShield::classifyAsync;
+		using NeuroShield::saveKnowledgeToSDcard;
+		using NeuroShield::saveCompactKnowledgeToSDcard;
+		using NeuroShield::checkpointKnowledgeToSDcard;
+		using NeuroShield::forEachNeuron;
+
+		uint16_t broadcast(Vector& vector) {
+			return (NeuroShield::broadcast(vector, VectorLen));
+		}
+
+		uint16_t learn(Vector& vector, uint16_t category) {
+			return (NeuroShield::learn(vector, VectorLen, category));
+		}
+
+		uint16_t learnBatch(const Vector vectors[], uint16_t count, const uint16_t categories[], LearnStats* stats) {
+			return (NeuroShield::learnBatch(vectors[0], count, VectorLen, categories, stats));
+		}
+
+		uint16_t classify(Vector& vector) {
+			return (NeuroShield::classify(vector, VectorLen));
+		}
+
+		uint16_t classify(Vector& vector, uint16_t* distance, uint16_t* category, uint16_t* nid) {
+			return (NeuroShield::classify(vector, VectorLen, distance, category, nid));
+		}
+
+		uint16_t classify(Vector& vector, uint16_t k, Result results[]) {
+			return (NeuroShield::classify(vector, VectorLen, k, results));
+		}
+
+		uint16_t classifyBatch(const Vector vectors[], uint16_t count, Result* out) {
+			return (NeuroShield::classifyBatch(vectors[0], count, VectorLen, out));
+		}
+
+		bool classifyAsync(const Vector& vector, ClassifyCallback callback, void* ctx) {
+			return (NeuroShield::classifyAsync(vector, VectorLen, callback, ctx));
+		}
+
+		void readNeuron(uint16_t nid, Record& neuron) {
+			NeuroShield::readNeuron(nid, neuron, VectorLen);
+		}
+
+		uint16_t readNeurons(uint16_t first, uint16_t count, Record neurons[]) {
+			return (NeuroShield::readNeurons(first, count, neurons[0], VectorLen));
+		}
+
+		// components in 8-bit, VectorLen + 8 bytes per neuron
+		void readNeuron(uint16_t nid, Neuron& neuron, Vector& comps) {
+			NeuroShield::readNeuron(nid, &neuron, comps, VectorLen);
+		}
+
+		uint16_t readNeurons(uint16_t first, uint16_t count, Neuron neurons[], Vector comps[]) {
+			return (NeuroShield::readNeurons(first, count, neurons, comps[0], VectorLen));
+		}
+
+		uint16_t forEachNeuron(NeuronCallback callback, void* ctx) {
+			return (NeuroShield::forEachNeuron(callback, ctx, VectorLen));
+		}
+
+		void writeNeurons(Record neurons[], uint16_t ncount) {
+			NeuroShield::writeNeurons(neurons[0], ncount, VectorLen);
+		}
+
+		// the knowledge file holds VectorLen components per neuron,
+		// loadKnowledgeFromSDcard() reads the length from its header
+		int saveKnowledgeToSDcard(char* filename) {
+			return (NeuroShield::saveKnowledgeToSDcard(filename, VectorLen));
+		}
+
+		int saveCompactKnowledgeToSDcard(char* filename, bool rle = true) {
+			return (NeuroShield::saveCompactKnowledgeToSDcard(filename, VectorLen, rle));
+		}
+
+		int checkpointKnowledgeToSDcard(char* filename, bool rle = true) {
+			return (NeuroShield::checkpointKnowledgeToSDcard(filename, VectorLen, rle));
+		}
+};
+
+#endif // _NEUROSHIELDT_H
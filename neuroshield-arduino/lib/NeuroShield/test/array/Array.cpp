@@ -0,0 +1,132 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board array learning test
+ *  Copyright (c) 2017 nepes inc.
+ *
+ *  Learns the same vectors on a NeuroShieldArray of two emulated chips
+ *  and on a single emulated chip with as many neurons, and checks that
+ *  both end with the same neurons and the same recognitions.
+ *
+ *  On Linux, build and run from this directory:
+ *    g++ -std=gnu++11 -pthread -I../../src ../../src/NM500*.cpp ../../src/NeuroShield*.cpp Array.cpp -o array
+ *    ./array            exit 1 on the first failed check
+ ******************************************************************************/
+
+#include <NeuroShield.h>
+#include <NeuroShieldArray.h>
+#include <NM500Emulator.h>
+#include <stdio.h>
+
+#define LENGTH		4
+#define MAXIF		100
+
+static int failures = 0;
+
+static void check(bool pass, const char* what) {
+	if (!pass) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void fill(uint8_t vector[], uint8_t value) {
+	for (uint8_t i = 0; i < LENGTH; i++)
+		vector[i] = value;
+}
+
+static bool sameNeurons(NeuroShieldArray& array, NeuroShield& single, uint16_t ncount) {
+	static uint16_t neuron[NEURON_SIZE + 4], expected[NEURON_SIZE + 4];
+	bool same = true;
+	for (uint16_t nid = 1; nid <= ncount; nid++) {
+		array.readNeuron(nid, neuron);
+		single.readNeuron(nid, expected);
+		for (uint16_t i = 0; i < NEURON_SIZE + 4; i++)
+			same = same && (neuron[i] == expected[i]);
+	}
+	return (same);
+}
+
+// ------------------------------------------------------------
+// A new neuron committed on the second chip takes its AIF from the
+// closest neuron of another category of the first chip, even when
+// that neuron does not fire
+// ------------------------------------------------------------
+static void closestNeuron() {
+	static const uint8_t slave_select[2] = { 7, 8 };
+	static const uint8_t vectors[3][2] = { { 0, 0 }, { 20, 0 }, { 0, 30 } };
+	static NeuroShieldArray array;
+	static NeuroShield single;
+	static NM500Emulator chip0(1), chip1(4), reference(5);
+	static uint16_t neuron[NEURON_SIZE + 4];
+
+	array.chip(0).spi.attach(&chip0);
+	array.chip(1).spi.attach(&chip1);
+	single.spi.attach(&reference);
+	check(array.begin(slave_select, 2) == 5, "array of 1 + 4 neurons");
+	check(single.begin(ARDUINO_SS) == 5, "single chip of 5 neurons");
+	array.forget(MAXIF);
+	single.forget(MAXIF);
+
+	// the neuron at (0, 0) fills the first chip and shrinks to 20, out
+	// of reach of (0, 30) which still limits the neuron of category 3
+	for (uint8_t i = 0; i < 3; i++) {
+		array.learn((uint8_t*)vectors[i], 2, 1 + i);
+		single.learn((uint8_t*)vectors[i], 2, 1 + i);
+	}
+	check(array.getNcount() == single.getNcount(), "same neuron count as a single chip");
+	check(sameNeurons(array, single, 3), "same neurons as a single chip");
+	array.readNeuron(3, neuron);
+	check(neuron[NEURON_SIZE + 1] == 30, "new neuron limited by a neuron which does not fire");
+}
+
+int main() {
+	static const uint8_t slave_select[2] = { 7, 8 };
+	static NeuroShieldArray array;
+	static NeuroShield single;
+	static NM500Emulator chip0(4), chip1(4), reference(8);
+	static uint16_t neuron[NEURON_SIZE + 4];
+	uint8_t vector[LENGTH];
+
+	array.chip(0).spi.attach(&chip0);
+	array.chip(1).spi.attach(&chip1);
+	single.spi.attach(&reference);
+	check(array.begin(slave_select, 2) == 8, "array of 8 neurons");
+	check(single.begin(ARDUINO_SS) == 8, "single chip of 8 neurons");
+	array.forget(MAXIF);
+	single.forget(MAXIF);
+
+	// fill the first chip, the neuron of category 1 is the one at 10
+	static const uint8_t values[4] = { 10, 100, 150, 200 };
+	for (uint8_t i = 0; i < 4; i++) {
+		fill(vector, values[i]);
+		array.learn(vector, LENGTH, 1 + i);
+		single.learn(vector, LENGTH, 1 + i);
+	}
+
+	// category 5 at 30 is committed on the second chip, within the
+	// influence field of the neuron of category 1 (distance 80)
+	fill(vector, 30);
+	check(array.learn(vector, LENGTH, 5) == 5, "neuron committed on the second chip");
+	single.learn(vector, LENGTH, 5);
+
+	// category 1 at 12 is recognized by the first chip (distance 8) and
+	// fires the neuron of category 5 of the second chip (distance 72):
+	// nothing is committed, but the neuron of category 5 must shrink
+	fill(vector, 12);
+	check(array.learn(vector, LENGTH, 1) == 5, "no neuron committed when a full chip recognizes the category");
+	single.learn(vector, LENGTH, 1);
+
+	check(array.getNcount() == single.getNcount(), "same neuron count as a single chip");
+	check(sameNeurons(array, single, 5), "same neurons as a single chip");
+	array.readNeuron(5, neuron);
+	check(neuron[NEURON_SIZE + 1] == 72, "neuron of category 5 shrunk to the distance of the vector");
+
+	uint16_t dist, cat, nid;
+	check(array.classify(vector, LENGTH, &dist, &cat, &nid) == 0x0008, "vector identified, not uncertain");
+	check((cat == 1) && (dist == 8) && (nid == 1), "identified by the neuron of category 1");
+
+	closestNeuron();
+	if (failures > 0)
+		return (1);
+	printf("array learning identical to a single chip\n");
+	return (0);
+}
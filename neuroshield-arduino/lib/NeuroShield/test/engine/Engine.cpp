@@ -0,0 +1,125 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board engine test
+ *  Copyright (c) 2017 nepes inc.
+ *
+ *  Learns the same random vectors with the NM500Engine and with a
+ *  NeuroShield on the NM500 emulator, and checks that both commit the
+ *  same neurons and give the same top-5 responses. The batch classifiers
+ *  of the engine are checked against its single vector classifiers.
+ *  The shards and the chunks are kept small so that the responses of
+ *  several shards are merged and the workers steal tasks.
+ *
+ *  On Linux, build and run from this directory:
+ *    g++ -std=gnu++11 -pthread -DNM500_ENGINE_SHARD=16 -DNM500_ENGINE_CHUNK=3 -I../../src ../../src/NM500*.cpp ../../src/NeuroShield*.cpp Engine.cpp -o engine
+ *    ./engine           exit 1 on the first failed check
+ *  Add -fsanitize=thread -g to check the workers for data races.
+ ******************************************************************************/
+
+#include <NeuroShield.h>
+#include <NM500Engine.h>
+#include <NM500Emulator.h>
+#include <stdio.h>
+
+#define LENGTH		24
+#define LEARNS		400
+#define CLASSIFIES	300
+#define K			5
+#define THREADS		4
+
+static int failures = 0;
+static uint16_t seed = 1;
+
+static void check(bool pass, const char* what) {
+	if (!pass) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static uint8_t nextRandom() {
+	seed = seed * 25173 + 13849;
+	return ((uint8_t)(seed >> 8));
+}
+
+// components in a narrow range, so that the influence fields overlap
+static void randomVector(uint8_t vector[]) {
+	for (uint16_t i = 0; i < LENGTH; i++)
+		vector[i] = nextRandom() % 40;
+}
+
+static bool same(const NeuroShield::Result& a, const NeuroShield::Result& b) {
+	return ((a.status == b.status) && (a.dist == b.dist) && (a.cat == b.cat) && (a.nid == b.nid));
+}
+
+int main() {
+	static NeuroShield hnn;
+	static NM500Engine engine(NM500_NEURONS, THREADS);
+	static uint8_t vectors[CLASSIFIES * LENGTH];
+	static NeuroShield::Result batch[CLASSIFIES * K], top1[CLASSIFIES];
+	static uint16_t neuron[LENGTH + 4], expected[LENGTH + 4];
+	NeuroShield::Result results[K], reference[K];
+	uint8_t vector[LENGTH];
+
+	check(hnn.begin() == NM500_NEURONS, "emulated chip ready");
+	check(engine.threadCount() == THREADS, "engine workers");
+	hnn.forget();
+	engine.forget();
+
+	// two contexts, so that the neurons out of context are skipped
+	bool learned = true;
+	for (uint16_t i = 0; i < LEARNS; i++) {
+		uint8_t context = 1 + (i % 2);
+		hnn.setContext(context);
+		engine.setContext(context);
+		randomVector(vector);
+		uint16_t category = 1 + (nextRandom() % 6);
+		learned = learned && (hnn.learn(vector, LENGTH, category) == engine.learn(vector, LENGTH, category));
+	}
+	check(learned, "same neuron count after each learn");
+	check(engine.getNcount() > (3 * NM500_ENGINE_SHARD), "neurons in several shards");
+
+	bool neurons = true;
+	for (uint16_t nid = 1; nid <= engine.getNcount(); nid++) {
+		hnn.readNeuron(nid, expected, LENGTH);
+		engine.readNeuron(nid, neuron, LENGTH);
+		for (uint16_t i = 0; i < (LENGTH + 4); i++)
+			neurons = neurons && (neuron[i] == expected[i]);
+	}
+	check(neurons, "same neurons as the emulator");
+
+	hnn.setContext(1);
+	engine.setContext(1);
+	for (uint16_t v = 0; v < CLASSIFIES; v++)
+		randomVector(&vectors[v * LENGTH]);
+
+	bool responses = true;
+	uint32_t recognized = 0;
+	for (uint16_t v = 0; v < CLASSIFIES; v++) {
+		uint16_t count = hnn.classify(&vectors[v * LENGTH], LENGTH, K, reference);
+		responses = responses && (engine.classify(&vectors[v * LENGTH], LENGTH, K, results) == count);
+		for (uint16_t i = 0; i < K; i++)
+			responses = responses && same(results[i], reference[i]);
+		if (count > 0)
+			recognized++;
+	}
+	check(responses, "same top-5 responses as the emulator");
+	check((recognized > 0) && (recognized < CLASSIFIES), "vectors recognized and unknown");
+
+	bool batches = (engine.classifyBatch(vectors, CLASSIFIES, LENGTH, K, batch) == recognized);
+	for (uint16_t v = 0; v < CLASSIFIES; v++) {
+		engine.classify(&vectors[v * LENGTH], LENGTH, K, results);
+		for (uint16_t i = 0; i < K; i++)
+			batches = batches && same(batch[v * K + i], results[i]);
+	}
+	check(batches, "classifyBatch top-5 identical to classify");
+
+	batches = (engine.classifyBatch(vectors, CLASSIFIES, LENGTH, top1) == recognized);
+	for (uint16_t v = 0; v < CLASSIFIES; v++)
+		batches = batches && same(top1[v], batch[v * K]);
+	check(batches, "classifyBatch top-1 identical to classify");
+
+	if (failures > 0)
+		return (1);
+	printf("engine identical to the emulator\n");
+	return (0);
+}
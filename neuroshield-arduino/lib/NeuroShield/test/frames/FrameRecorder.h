@@ -0,0 +1,22 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board SPI frame recorder
+ *  Copyright (c) 2017 nepes inc.
+ *  
+ *  Included ahead of the library (g++ -include FrameRecorder.h) so that
+ *  the buffered transfers of NeuroShieldSPI go through recordTransfer()
+ *  before the NM500 emulator serves them.
+ ******************************************************************************/
+
+#ifndef _FRAMERECORDER_H
+#define _FRAMERECORDER_H
+
+#include <stdint.h>
+
+class NM500Emulator;
+
+// keep the bytes sent by a transfer, then exchange them with nm500
+void recordTransfer(NM500Emulator* nm500, uint8_t* buf, uint16_t len);
+
+#define NM500_SPI_TRANSFER(buf, len)	recordTransfer(emulator, (buf), (len))
+
+#endif
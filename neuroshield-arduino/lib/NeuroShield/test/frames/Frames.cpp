@@ -0,0 +1,223 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board SPI frame regression test
+ *  Copyright (c) 2017 nepes inc.
+ *
+ *  Runs the public calls of NeuroShield against the NM500 emulator and
+ *  compares the frames they put on the bus, byte for byte, with the
+ *  frames recorded in frames.txt: one "== call" line per call followed
+ *  by one line per frame with the bytes sent while SS was low.
+ *
+ *  On Linux, build and run from this directory:
+ *    g++ -std=gnu++11 -pthread -include FrameRecorder.h -I. -I../../src ../../src/NM500*.cpp ../../src/NeuroShield*.cpp Frames.cpp -o frames
+ *    ./frames           compare with frames.txt, exit 1 on the first difference
+ *    ./frames record    rewrite frames.txt after an intended change of the wire format
+ ******************************************************************************/
+
+#include "FrameRecorder.h"
+
+#include <NeuroShield.h>
+#include <NM500Emulator.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define FRAMES_FILE		"frames.txt"
+
+static std::string frames;				// recorded frames of the calls run so far
+static NM500Emulator* last_emulator = nullptr;
+static uint32_t last_frame = 0;
+
+// ------------------------------------------------------------
+// Recorder
+// The emulator counts the slave select falling edges, a transfer
+// made after a new edge starts a new frame
+// ------------------------------------------------------------
+void recordTransfer(NM500Emulator* nm500, uint8_t* buf, uint16_t len) {
+	char hex[3];
+	if ((nm500 != last_emulator) || (nm500->frames != last_frame)) {
+		frames += "\n";
+		last_emulator = nm500;
+		last_frame = nm500->frames;
+	}
+	for (uint16_t i = 0; i < len; i++) {
+		snprintf(hex, sizeof(hex), "%02x", buf[i]);
+		frames += hex;
+	}
+	nm500->transfer(buf, len);
+}
+
+static void call(const char* name) {
+	frames += "\n== ";
+	frames += name;
+	last_emulator = nullptr;
+}
+
+// ------------------------------------------------------------
+// Comparison with the recorded frames
+// ------------------------------------------------------------
+static bool readFile(const char* name, std::string& text) {
+	FILE* f = fopen(name, "rb");
+	if (f == NULL)
+		return (false);
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, n);
+	fclose(f);
+	return (true);
+}
+
+// name of the call of the line at pos
+static std::string callAt(const std::string& text, size_t pos) {
+	size_t start = text.rfind("\n== ", pos);
+	if (start == std::string::npos)
+		return ("(none)");
+	start += 4;
+	return (text.substr(start, text.find('\n', start) - start));
+}
+
+static int compare(const std::string& expected) {
+	size_t pos = 0;
+	while ((pos < expected.size()) && (pos < frames.size()) && (expected[pos] == frames[pos]))
+		pos++;
+	if ((pos == expected.size()) && (pos == frames.size())) {
+		printf("frames identical\n");
+		return (0);
+	}
+	size_t line = expected.rfind('\n', pos);
+	line = (line == std::string::npos) ? 0 : line + 1;
+	printf("frames differ in %s\n", callAt(frames, line).c_str());
+	printf("expected: %s\n", expected.substr(line, expected.find('\n', line) - line).c_str());
+	printf("actual:   %s\n", frames.substr(line, frames.find('\n', line) - line).c_str());
+	return (1);
+}
+
+// ------------------------------------------------------------
+// Calls
+// ------------------------------------------------------------
+static void onResult(void* ctx, const NeuroShield::Result& result) {
+	*(NeuroShield::Result*)ctx = result;
+}
+
+static bool countNeuron(void* ctx, uint16_t, const NeuroShield::Neuron&, const uint8_t[], uint16_t) {
+	(*(uint16_t*)ctx)++;
+	return (true);
+}
+
+static void run(NeuroShield& hnn) {
+	static uint16_t neurons[8 * (NEURON_SIZE + 4)];
+	uint8_t vector[24], far[24], vectors[3 * 24], comps[3 * 24];
+	uint16_t words[NEURON_SIZE];
+	uint16_t categories[3] = { 10, 20, 10 };
+	uint16_t dist, cat, nid, ncr, aif, minif, maxif, count = 0;
+	uint16_t dists[5], cats[5], nids[5];
+	uint8_t context;
+	NeuroShield::Result results[5], async_result;
+	NeuroShield::Neuron regs[3];
+	NeuroShield::LearnStats stats;
+
+	for (uint8_t i = 0; i < sizeof(vector); i++)
+		vector[i] = i * 3;
+	memset(far, 0xFF, sizeof(far));
+	for (uint8_t i = 0; i < sizeof(vectors); i++)
+		vectors[i] = (uint8_t)(i * 7 + 40);
+
+	call("begin");					hnn.begin(ARDUINO_SS);
+	call("fpgaVersion");			hnn.fpgaVersion();
+	call("setGcr");					hnn.setGcr(1);
+	call("getGcr");					hnn.getGcr();
+	call("setNcr");					hnn.setNcr(3);
+	call("getNcr");					hnn.getNcr();
+	call("setComp");				hnn.setComp(0xAB);
+	call("getComp");				hnn.getComp();
+	call("setLastComp");			hnn.setLastComp(5);
+	call("setIndexComp");			hnn.setIndexComp(2);
+	call("getDist");				hnn.getDist();
+	call("setCat");					hnn.setCat(0x1234);
+	call("getCat");					hnn.getCat();
+	call("setAif");					hnn.setAif(0x4000);
+	call("getAif");					hnn.getAif();
+	call("setMinif");				hnn.setMinif(2);
+	call("getMinif");				hnn.getMinif();
+	call("setMaxif");				hnn.setMaxif(300);
+	call("getMaxif");				hnn.getMaxif();
+	call("getNid");					hnn.getNid();
+	call("resetChain");				hnn.resetChain();
+	call("setNsr");					hnn.setNsr(0);
+	call("getNsr");					hnn.getNsr();
+	call("getNcount");				hnn.getNcount();
+	call("setPowerSave");			hnn.setPowerSave();
+	call("forget");					hnn.forget();
+	call("forget maxif");			hnn.forget(1000);
+	call("setContext");				hnn.setContext(1);
+	call("setContext minif maxif");	hnn.setContext(1, 2, 0x4000);
+	call("getContext");				hnn.getContext(&context, &minif, &maxif);
+	call("setKnnClassifier");		hnn.setKnnClassifier();
+	call("setRbfClassifier");		hnn.setRbfClassifier();
+
+	call("learn");					hnn.learn(vector, 24, 3);
+	call("learn short");			hnn.learn(vector, 1, 7);
+	call("learnBatch");				hnn.learnBatch(vectors, 3, 24, categories, &stats);
+	call("broadcast");				hnn.broadcast(vector, 24);
+	call("classify");				hnn.classify(vector, 24);
+	call("classify top-1");			hnn.classify(vector, 24, &dist, &cat, &nid);
+	call("classify top-k");			hnn.classify(vector, 24, 5, dists, cats, nids);
+	call("classify results");		hnn.classify(vector, 24, 5, results);
+	call("classifyDistances");		hnn.classifyDistances(vector, 24, 5, dists);
+	call("classifyBatch");			hnn.classifyBatch(vectors, 3, 24, results);
+	call("classifyAsync");
+	hnn.classifyAsync(vector, 24, onResult, &async_result);
+	while (hnn.poll());
+	call("setKnnClassifier");		hnn.setKnnClassifier();
+	call("classify knn top-k");		hnn.classify(vector, 24, 5, dists, cats, nids);
+	call("classify knn results");	hnn.classify(far, 24, 5, results);
+	call("classifyDistances knn");	hnn.classifyDistances(far, 24, 5, dists);
+	call("setRbfClassifier");		hnn.setRbfClassifier();
+
+	call("readNeuron model");		hnn.readNeuron(3, words, &ncr, &aif, &cat);
+	call("readNeuron");				hnn.readNeuron(2, neurons);
+	call("readNeuron length");		hnn.readNeuron(1, neurons, 24);
+	call("readNeuron 8-bit");		hnn.readNeuron(2, &regs[0], comps, 24);
+	call("readNeurons");			hnn.readNeurons(neurons);
+	call("readNeurons range");		hnn.readNeurons(2, 2, neurons, 24);
+	call("readNeurons 8-bit");		hnn.readNeurons(1, 3, regs, comps, 24);
+	call("forEachNeuron");			hnn.forEachNeuron(countNeuron, &count, 24);
+	call("beginNeuronRead");		hnn.beginNeuronRead();
+	call("readCompVector");			hnn.readCompVector(words, 10);
+	call("readCompVector 8-bit");	hnn.readCompVector(comps, 10);
+	call("endNeuronRead");			hnn.endNeuronRead();
+
+	for (uint16_t i = 0; i < 3 * (24 + 4); i++)
+		neurons[i] = i * 5 + 1;
+	call("writeNeurons");			hnn.writeNeurons(neurons, 3, 24);
+	call("beginRestore");			hnn.beginRestore(24);
+	call("restoreRecords");			hnn.restoreRecords(neurons, 2 * (24 + 4));
+	call("endRestore");				hnn.endRestore();
+	call("writeCompVector");		hnn.writeCompVector(words, 7);
+	call("testCommand read");		hnn.testCommand(0, NM_CAT, 0);
+	call("testCommand write");		hnn.testCommand(1, NM_CAT, 77);
+	call("nm500Reset");				hnn.nm500Reset();
+	call("ledSelect");				hnn.ledSelect(3);
+	frames += "\n";
+}
+
+int main(int argc, char* argv[]) {
+	static NeuroShield hnn;
+	run(hnn);
+
+	if ((argc > 1) && (strcmp(argv[1], "record") == 0)) {
+		FILE* f = fopen(FRAMES_FILE, "wb");
+		if ((f == NULL) || (fwrite(frames.data(), 1, frames.size(), f) != frames.size()))
+			return (1);
+		fclose(f);
+		printf("frames recorded\n");
+		return (0);
+	}
+
+	std::string expected;
+	if (!readFile(FRAMES_FILE, expected)) {
+		printf("%s not found\n", FRAMES_FILE);
+		return (1);
+	}
+	return (compare(expected));
+}
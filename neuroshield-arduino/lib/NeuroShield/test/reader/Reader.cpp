@@ -0,0 +1,112 @@
+/******************************************************************************
+ *  NM500 NeuroShield Board knowledge file reader test
+ *  Copyright (c) 2017 nepes inc.
+ *
+ *  Writes knowledge files in the layout of saveKnowledgeToSDcard(), opens
+ *  them with KnReader and checks the error codes of open() for the files
+ *  it must refuse, then the records and the category and context indexes
+ *  of a valid file.
+ *
+ *  On Linux, build and run from this directory:
+ *    g++ -std=gnu++11 -pthread -I../../src ../../src/NM500*.cpp ../../src/NeuroShield*.cpp Reader.cpp -o reader
+ *    ./reader           exit 1 on the first failed check
+ ******************************************************************************/
+
+#include <NeuroShield.h>
+#include <NeuroShieldKnowledge.h>
+#include <NeuroShieldKnowledgeReader.h>
+#include <stdio.h>
+
+#define KN_FILE		"reader.knf"
+#define LENGTH		4
+
+static int failures = 0;
+
+static void check(bool pass, const char* what) {
+	if (!pass) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// ------------------------------------------------------------
+// Knowledge files, little-endian words
+// ------------------------------------------------------------
+static void putWord(FILE* f, uint16_t word) {
+	fputc(word & 0xFF, f);
+	fputc(word >> 8, f);
+}
+
+// header followed by the records of neurons, count * (LENGTH + 4) words
+static void writeFile(uint16_t format, uint16_t ncount, const uint16_t neurons[], uint16_t count) {
+	FILE* f = fopen(KN_FILE, "wb");
+	putWord(f, format);
+	putWord(f, LENGTH);
+	putWord(f, ncount);
+	putWord(f, 0);
+	for (uint32_t i = 0; i < (uint32_t)count * (LENGTH + 4); i++)
+		putWord(f, neurons[i]);
+	fclose(f);
+}
+
+int main() {
+	// NCR (context), 4 components, AIF, MINIF, CAT
+	static const uint16_t neurons[5 * (LENGTH + 4)] = {
+		1,	10, 11, 12, 13,	100, 2, 3,
+		2,	20, 21, 22, 23,	200, 2, 1,
+		1,	30, 31, 32, 33,	300, 2, 0x8003,		// degenerated
+		2,	40, 41, 42, 43,	400, 2, 3,
+		1,	50, 51, 52, 53,	500, 2, 1,
+	};
+	KnReader kn;
+	const uint16_t* values;
+	const uint16_t* nids;
+
+	check(kn.records() == nullptr, "no records before open");
+	check(kn.open("missing.knf") == 2, "missing file");
+
+	FILE* f = fopen(KN_FILE, "wb");
+	putWord(f, KN_FORMAT);
+	fclose(f);
+	check(kn.open(KN_FILE) == 4, "file shorter than the header");
+
+	writeFile(KN_FORMAT_COMPACT, 5, neurons, 5);
+	check(kn.open(KN_FILE) == 4, "compact file refused");
+	writeFile(KN_FORMAT_CHECKPOINT, 5, neurons, 5);
+	check(kn.open(KN_FILE) == 4, "checkpoint file refused");
+	writeFile(0x0100, 5, neurons, 5);
+	check(kn.open(KN_FILE) == 4, "unknown magic number");
+	writeFile(KN_FORMAT, 0xFFFF, neurons, 5);
+	check(kn.open(KN_FILE) == 6, "more than 0xFFFE neurons");
+	writeFile(KN_FORMAT, 6, neurons, 5);
+	check(kn.open(KN_FILE) == 7, "truncated file");
+	check(!kn.isOpen() && (kn.records() == nullptr) && (kn.ncount() == 0), "nothing open after a refused file");
+
+	writeFile(KN_FORMAT, 5, neurons, 5);
+	check(kn.open(KN_FILE) == 0, "valid file");
+	check((kn.length() == LENGTH) && (kn.ncount() == 5), "length and neuron count");
+	check((kn.records() != nullptr) && (kn.records()[LENGTH + 4] == 2), "records in place");
+	check((kn.neuron(4).comp(1) == 41) && (kn.neuron(4).aif() == 400), "neuron 4");
+	check((kn.neuron(0).cat() == 0) && (kn.neuron(6).cat() == 0), "empty record out of range");
+
+	check(kn.categories(&values) == 2, "two categories");
+	check((values[0] == 1) && (values[1] == 3), "categories by increasing value");
+	check((kn.categoryNeurons(1, &nids) == 2) && (nids[0] == 2) && (nids[1] == 5), "neurons of category 1");
+	check((kn.categoryNeurons(3, &nids) == 3) && (nids[0] == 1) && (nids[1] == 3) && (nids[2] == 4), "neurons of category 3, degenerated or not");
+	check((kn.categoryNeurons(0x8003, &nids) == 3) && (nids[0] == 1), "degenerated flag masked");
+	check((kn.categoryNeurons(2, &nids) == 0) && (nids == nullptr), "no neuron of category 2");
+
+	check(kn.contexts(&values) == 2, "two contexts");
+	check((values[0] == 1) && (values[1] == 2), "contexts by increasing value");
+	check((kn.contextNeurons(1, &nids) == 3) && (nids[0] == 1) && (nids[1] == 3) && (nids[2] == 5), "neurons of context 1");
+	check((kn.contextNeurons(2, &nids) == 2) && (nids[0] == 2) && (nids[1] == 4), "neurons of context 2");
+
+	kn.close();
+	check(kn.records() == nullptr, "no records after close");
+	remove(KN_FILE);
+
+	if (failures > 0)
+		return (1);
+	printf("knowledge file reader checks passed\n");
+	return (0);
+}